@@ -54,6 +54,7 @@ import time
 import urllib.error
 import urllib.parse
 import urllib.request
+import zlib
 
 import orjson
 
@@ -483,6 +484,40 @@ def cat_fragments(output_file_name, fragment_list):
             output_file.write(data)
 
 
+def inspected_state(file_name):
+    """Looks up what rawrcvb's inspection (RAWRCV_INSPECT, see
+    rawxfer/inspect.c) found for a received file
+
+    Return:
+        "prefix", "complete", "trailing", "bad" or "unknown"
+        None if there is no record, or the file no longer matches it
+    """
+    head, tail = os.path.split(file_name)
+    manifest = os.path.join(head, "." + tail[:8] + ".manifest")
+    entry = None
+    try:
+        with open(manifest, "r") as fi:
+            # One line per fragment - rawrcvb rewrites it on a resend
+            for line in fi:
+                fields = line.split()
+                if len(fields) == 5 and fields[0] == tail:
+                    entry = fields
+                    break
+        if entry is None or os.path.getsize(file_name) != int(entry[1]):
+            return None
+        expected = int(entry[2], 16)
+        crc = 0
+        with open(file_name, "rb") as fi:
+            for chunk in iter(lambda: fi.read(1 << 20), b""):
+                crc = zlib.crc32(chunk, crc)
+    except (OSError, ValueError):
+        return None
+
+    if crc != expected:
+        return None
+    return entry[4]
+
+
 def test_decompress(inp_file_name, inp_file_list):
     """Tests which of the two input inputs decompresses better
 
@@ -491,6 +526,21 @@ def test_decompress(inp_file_name, inp_file_list):
         False if inp_file_list is better
     """
 
+    # If rawrcvb already ran both through the decompressor, go with that
+    whole_state = inspected_state(inp_file_name)
+    if whole_state == "complete":
+        log_debug(f"{inp_file_name} inspected as complete on receipt")
+        return True
+    frag_states = [inspected_state(f) for f in inp_file_list]
+    if (
+        whole_state in ("prefix", "trailing", "bad")
+        and None not in frag_states
+        and "unknown" not in frag_states
+        and frag_states[-1] == "complete"
+    ):
+        log_debug(f"{inp_file_name} inspected as {whole_state}, fragments as complete")
+        return False
+
     tmp_file = inp_file_name + ".temp"
     ret1 = BaseGZip.decompress(inp_file_name, tmp_file)
     os.unlink(tmp_file)
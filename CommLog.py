@@ -697,6 +697,7 @@ class ConnectSession:
         self.transfer_direction = {}
         self.transfered_size = {}
         self.crc_errors = {}
+        self.link_profiles = []  # from load_rawrcv_profile
         self.cmd_directive = None
         self.logout_status = None
         # Dictionary of the file with send retries with in the sesssion
@@ -1924,6 +1925,54 @@ def process_history_log(history_log_file_name):
     return command_history
 
 
+def load_rawrcv_profile(profile_file_name, comm_log=None):
+    """Reads the per-file link profiles rawrcv/rawrcvb append to the file
+    named by RAWRCV_PROFILE (see rawxfer/profile.c)
+
+    If comm_log is given, each record is also added to the link_profiles
+    of the session it falls in
+
+    Returns a list of dicts, one per file received, in the order written
+    None if the file could not be read
+    """
+    try:
+        profile_file = open(profile_file_name, "rb")
+    except IOError:
+        log_error(f"Could not open {profile_file_name} for reading.")
+        return None
+
+    records = []
+    with profile_file:
+        for line_count, raw_line in enumerate(profile_file, 1):
+            try:
+                record = json.loads(raw_line)
+            except ValueError:
+                # A receiver killed part way through a write
+                log_warning(
+                    f"Could not process line {line_count} in {profile_file_name} - skipping"
+                )
+                continue
+            elapsed = record["elapsed_us"] / 1e6
+            record["throughput"] = record["received"] / elapsed if elapsed else 0.0
+            # Fraction of the transfer spent waiting on the modem
+            record["stalled"] = (
+                record["select_us"] / record["elapsed_us"]
+                if record["elapsed_us"]
+                else 0.0
+            )
+            records.append(record)
+
+    if comm_log is not None:
+        starts = [time.mktime(session.connect_ts) for session in comm_log.sessions]
+        for record in records:
+            for i in range(len(starts) - 1, -1, -1):
+                if starts[i] <= record["start"]:
+                    comm_log.sessions[i].link_profiles.append(record)
+                    break
+
+    return records
+
+
 def merge_lists_with_ts(list1, list2):
     """Assumes list 1 much longer then list 2
     new_list = None
@@ -0,0 +1,1157 @@
+//
+// Copyright (c) 2018, 2021, 2023 University of Washington.  All rights reserved.
+//
+// This file contains proprietary information and remains the 
+// unpublished property of the University of Washington. Use, disclosure,
+// or reproduction is prohibited.
+//
+
+// gcc -O2 -fPIC -shared -o libad2cp.so ad2cp.c matfile.c -lm -lz
+//
+// Per-ensemble variables are contiguous and grow geometrically with the
+// record stream, matrices held one ensemble (column) after another - the
+// MAT-file order.  Only the beams written out, and the amp/corr fields
+// the first data record's headconfig says are present, are stored.  All
+// buffers handed to one Ad2cp append to the same set of variables.
+
+# define _GNU_SOURCE
+# include <stdio.h>
+# include <stddef.h>
+# include <math.h>
+# include <string.h>
+# include <time.h>
+# include <stdlib.h>
+# include <unistd.h>
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include "matfile.h"
+# include "ad2cp.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define XYZ_AVX2
+#include <immintrin.h>
+#endif
+
+typedef struct
+{
+    unsigned short beamData1 :4;
+    unsigned short beamData2 :4;
+    unsigned short beamData3 :4;
+    unsigned short beamData4 :4;
+} t_DataSetDescription4Bit;
+
+typedef struct
+{
+    unsigned int _empty1               :1;
+    unsigned int bdScaling             :1;
+    unsigned int _empty2               :1;
+    unsigned int _empty3               :1;
+    unsigned int _empty4               :1;
+    unsigned int echoFreqBin           :5;
+    unsigned int boostRunning              :1;
+    unsigned int telemetryData             :1;
+    unsigned int echoIndex                 :4;
+    unsigned int activeConfiguration       :1;
+    unsigned int lastmeasLowVoltageSkip    :1;
+    unsigned int prevWakeUpState           :4;
+    unsigned int autoOrient                :3;
+    unsigned int orientation               :3;
+    unsigned int wakeupstate               :4;
+} t_status;
+
+typedef struct
+{
+    unsigned short  procIdle3   :1;
+    unsigned short  procIdle6   :1;
+    unsigned short  procIdle12  :1;
+    unsigned short  _empty1     :12;
+    unsigned short  stat0inUse  :1;
+} t_status0;
+
+#define VERSION_DATA_STRUCT_3   3
+
+typedef struct 
+{
+    unsigned char version;
+    unsigned char offsetOfData;
+    struct {
+        unsigned short pressure         :1;
+        unsigned short temp             :1;
+        unsigned short compass          :1;
+        unsigned short tilt             :1;
+        unsigned short _empty           :1;
+        unsigned short velIncluded      :1;
+        unsigned short ampIncluded      :1;
+        unsigned short corrIncluded     :1;
+        unsigned short altiIncluded     :1;
+        unsigned short altiRawIncluded  :1;
+        unsigned short ASTIncluded      :1;
+        unsigned short echoIncluded     :1;
+        unsigned short ahrsIncluded     :1;
+        unsigned short PGoodIncluded    :1;
+        unsigned short stdDevIncluded   :1;
+        unsigned short _unused          :1;
+    } headconfig;
+    unsigned int serialNumber;
+    unsigned char year;
+    unsigned char month;
+    unsigned char day;
+    unsigned char hour;
+    unsigned char minute;
+    unsigned char second;
+    unsigned short microSeconds100;
+    unsigned short soundSpeed;
+    short          temperature;
+    unsigned int  pressure;
+    unsigned short heading;
+    short          pitch;
+    short          roll;
+    union {
+        struct {
+            unsigned short numCells    :10;
+            unsigned short coordSystem :2;
+            unsigned short numBeams    :4;
+        } beams_cy_cells;
+        unsigned short echo_cells;
+    };
+    unsigned short cellSize;
+    unsigned short blanking;
+    unsigned char  nominalCorrelation; 
+    unsigned char  pressTemp;
+    unsigned short battery;
+    short          magnHxHyHz[3];
+    short          accl3D[3];
+    union {
+        unsigned short ambVelocity;
+        unsigned short echoFrequency;
+    };
+    t_DataSetDescription4Bit DataSetDescription4bit;   // ushort
+    unsigned short transmitEnergy;  
+    char           velocityScaling;
+    char           powerLevel;
+    short          magnTemperature;
+    short          rtcTemperature;
+    unsigned short error;
+    t_status0      status0; // ushort
+    t_status       status;  // ulong
+    unsigned int  ensembleCounter;
+    unsigned char  data[512];
+    ///< actual size of the following = 4*nbeams*ncells = 4*4*30
+    ///<    int16_t hVel[nBeams][nCells];
+    ///<    uint8_t cAmp[nBeams][nCells];
+    ///<    uint8_t cCorr[nBeams][nCells];
+} OutputData3_t;
+
+// Expected transformation matrixes
+// BEAM 124
+// 3,3,1.3564,-0.5056,-0.5056,0.0000,-1.1831,1.1831,0.0000,0.5518,0.5518
+static double beam_124[3][3] = {
+    {1.3564,-0.5056,-0.5056},
+    {0.0000,-1.1831,1.1831},
+    {0.0000,0.5518,0.5518},
+};
+
+// BEAM 234
+// 3,3,0.5056,-1.3564,0.5056,-1.1831,0.0000,1.1831,0.5518,0.0000,0.5518
+static double beam_234[3][3] = {
+    {0.5056,-1.3564,0.5056},
+    {-1.1831,0.0000,1.1831},
+    {0.5518,0.0000,0.5518},
+};
+
+static double beam_ident[3][3] = {
+    {1., 0., 0.},
+    {0., 1., 0.},
+    {0., 0., 1.},
+};
+
+// Compares to 3x3 double matrices
+// Returns: 0 for equal, 1 for not equal
+
+static int
+matrix_equal(double *A, double *B) {
+    for(int ii = 0; ii < 3; ii++) {
+        for(int jj = 0; jj < 3; jj++) {
+            if( *(A + ii * 3 + jj) != *(B + ii * 3 + jj)) return 1;
+        }
+    }
+    return 0;
+}
+
+// Beam to XYZ for 3-beam ensembles.  The velocities arrive as three
+// int16 runs of stride cells, one per beam, and leave as the x, y and z
+// columns of the ensemble - both already structure-of-arrays - so each
+// kernel takes a whole ensemble, fusing in the scaling.  All of them do
+// the arithmetic in the same order as the original per-cell loop
+// (v = scale*h, then x = T00*v0 + T01*v1 + T02*v2) so, with no fused
+// multiply-add, they agree with it to the bit.
+
+typedef void (*xyz_fn_t)(const short *hVel, int stride, int n, double scale,
+                         const double *T, double *x, double *y, double *z);
+
+/// Straight-line loop over cells the compiler can vectorize as it likes
+static void
+xyz_soa(const short *hVel, int stride, int n, double scale,
+        const double *T, double *restrict x, double *restrict y, double *restrict z)
+{
+    const short *h0 = hVel, *h1 = hVel + stride, *h2 = hVel + 2*stride;
+    double       v0, v1, v2;
+    int          i;
+
+    for (i = 0 ; i < n ; i ++) {
+        v0 = scale*h0[i];
+        v1 = scale*h1[i];
+        v2 = scale*h2[i];
+        x[i] = T[0]*v0 + T[1]*v1 + T[2]*v2;
+        y[i] = T[3]*v0 + T[4]*v1 + T[5]*v2;
+        z[i] = T[6]*v0 + T[7]*v1 + T[8]*v2;
+    }
+}
+
+#ifdef XYZ_AVX2
+/// Four cells at a time
+__attribute__((target("avx2")))
+static void
+xyz_avx2(const short *hVel, int stride, int n, double scale,
+         const double *T, double *x, double *y, double *z)
+{
+    const short *h0 = hVel, *h1 = hVel + stride, *h2 = hVel + 2*stride;
+    __m256d      s = _mm256_set1_pd(scale);
+    __m256d      t[9];
+    __m256d      v0, v1, v2;
+    int          i;
+
+    for (i = 0 ; i < 9 ; i++)
+        t[i] = _mm256_set1_pd(T[i]);
+
+#define XYZ_LOAD(h) \
+    _mm256_mul_pd(s, _mm256_cvtepi32_pd(_mm_cvtepi16_epi32(_mm_loadl_epi64((const __m128i *) (h)))))
+#define XYZ_ROW(a, b, c) \
+    _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(a, v0), _mm256_mul_pd(b, v1)), _mm256_mul_pd(c, v2))
+
+    for (i = 0 ; i + 4 <= n ; i += 4) {
+        v0 = XYZ_LOAD(h0 + i);
+        v1 = XYZ_LOAD(h1 + i);
+        v2 = XYZ_LOAD(h2 + i);
+        _mm256_storeu_pd(x + i, XYZ_ROW(t[0], t[1], t[2]));
+        _mm256_storeu_pd(y + i, XYZ_ROW(t[3], t[4], t[5]));
+        _mm256_storeu_pd(z + i, XYZ_ROW(t[6], t[7], t[8]));
+    }
+
+#undef XYZ_LOAD
+#undef XYZ_ROW
+
+    if (i < n)
+        xyz_soa(h0 + i, stride, n - i, scale, T, x + i, y + i, z + i);
+}
+#endif
+
+static xyz_fn_t
+xyz_select(void)
+{
+#ifdef XYZ_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return xyz_avx2;
+#endif
+    return xyz_soa;
+}
+
+
+static xyz_fn_t xyz;
+
+/// Makes room for cap records of width elements of size bytes in *x
+/// \return 0, or -1 with *x left as it was
+static int
+Reserve(void *x, int cap, int width, size_t size)
+{
+    void      *p;
+
+    p = realloc(*(void **) x, size * cap * (width ? width : 1));
+    if (p == NULL) {
+        fprintf(stderr, "libad2cp: out of memory at %d ensembles\n", cap);
+        return -1;
+    }
+    *(void **) x = p;
+    return 0;
+}
+
+/// Maps name (or, failing that, reads it whole)
+/// \return start of the contents, NULL if it cannot be opened
+unsigned char *
+MapFile(const char *name, size_t *len, int *mapped)
+{
+    struct stat    st;
+    unsigned char *p, *q;
+    size_t         cap;
+    ssize_t        n;
+    int            fd;
+
+    if ((fd = open(name, O_RDONLY)) < 0)
+        return NULL;
+
+    *len = 0;
+    *mapped = 0;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            madvise(p, st.st_size, MADV_SEQUENTIAL);
+            close(fd);
+            *len = st.st_size;
+            *mapped = 1;
+            return p;
+        }
+    }
+
+    cap = 65536;
+    if ((p = malloc(cap)) == NULL) {
+        close(fd);
+        return NULL;
+    }
+    while ((n = read(fd, p + *len, cap - *len)) > 0) {
+        if ((*len += n) == cap) {
+            if ((q = realloc(p, cap *= 2)) == NULL)
+                break;
+            p = q;
+        }
+    }
+    close(fd);
+    return p;
+}
+
+void
+UnmapFile(unsigned char *p, size_t len, int mapped)
+{
+    if (mapped)
+        munmap(p, len);
+    else
+        free(p);
+}
+
+Ad2cp *
+Ad2cpNew(int verbose)
+{
+    Ad2cp     *a;
+
+    if ((a = calloc(1, sizeof(Ad2cp))) == NULL)
+        return NULL;
+
+    // records mostly run to 64k, plus a NUL for the string searches;
+    // long-form ones grow it
+    a->reccap = 65536 + 1;
+    if ((a->rec = malloc(a->reccap)) == NULL) {
+        free(a);
+        return NULL;
+    }
+    a->verbose = verbose;
+    a->date = -1;
+    if (xyz == NULL)
+        xyz = xyz_select();
+    return a;
+}
+
+void
+Ad2cpFree(Ad2cp *a)
+{
+    int        j;
+
+    if (a == NULL)
+        return;
+    for (j = 0 ; j < 4 ; j++) {
+        free(a->beamv[j]);
+        free(a->corr[j]);
+        free(a->amp[j]);
+    }
+    free(a->echo);
+    free(a->beamN);
+    free(a->power);
+    free(a->temperature);
+    free(a->pressure);
+    free(a->heading);
+    free(a->roll);
+    free(a->pitch);
+    free(a->t);
+    free(a->magX);
+    free(a->magY);
+    free(a->magZ);
+    free(a->rec);
+    free(a);
+}
+
+/// Makes room in every column of the current mode for cap ensembles
+static int
+Room(Ad2cp *a, int cap)
+{
+    int        j, bad = 0;
+
+    if (a->mode == 0x1c) {
+        bad |= Reserve(&a->echo, cap, a->num_cells, sizeof(double));
+        bad |= Reserve(&a->beamN, cap, 1, sizeof(short));
+        bad |= Reserve(&a->power, cap, 1, sizeof(short));
+    }
+    else {
+        for (j = 0 ; j < a->nout ; j++) {
+            bad |= Reserve(&a->beamv[j], cap, a->num_cells, sizeof(double));
+            if (a->corrIncluded)
+                bad |= Reserve(&a->corr[j], cap, a->num_cells, 1);
+            if (a->ampIncluded)
+                bad |= Reserve(&a->amp[j], cap, a->num_cells, 1);
+        }
+    }
+    bad |= Reserve(&a->t, cap, 1, sizeof(double));
+    bad |= Reserve(&a->pressure, cap, 1, sizeof(double));
+    bad |= Reserve(&a->pitch, cap, 1, sizeof(double));
+    bad |= Reserve(&a->roll, cap, 1, sizeof(double));
+    bad |= Reserve(&a->heading, cap, 1, sizeof(double));
+    bad |= Reserve(&a->temperature, cap, 1, sizeof(double));
+
+    bad |= Reserve(&a->magX, cap, 1, sizeof(short));
+    bad |= Reserve(&a->magY, cap, 1, sizeof(short));
+    bad |= Reserve(&a->magZ, cap, 1, sizeof(short));
+    if (bad)
+        return -1;
+
+    a->cap = cap;
+    if(a->verbose) printf("room for %d ensembles\n", cap);
+    return 0;
+}
+
+/// Grows every column of the current mode to twice its ensembles
+static int
+Grow(Ad2cp *a)
+{
+    return Room(a, a->cap ? a->cap * 2 : 1024);
+}
+
+/// Checks a GETXFAVG transformation against the matrices we know
+/// \return 0, or -1 if it is one we do not
+static int
+Xfavg(Ad2cp *a, char *str)
+{
+    double T_tmp[3][3];
+    int    n;
+
+    n = sscanf(str, "GETXFAVG,ROWS=3,COLS=3,M11=%lf,M12=%lf,M13=%lf,M21=%lf,M22=%lf,M23=%lf,M31=%lf,M32=%lf,M33=%lf",
+               &T_tmp[0][0], &T_tmp[0][1], &T_tmp[0][2],
+               &T_tmp[1][0], &T_tmp[1][1], &T_tmp[1][2],
+               &T_tmp[2][0], &T_tmp[2][1], &T_tmp[2][2]);
+    if( n != 9 ) {
+        fprintf(stderr, "WARNING - poorly formed GETXAVG string (%s) - ignoring\n", str);
+    } else {
+        if( !matrix_equal(&T_tmp[0][0], &beam_124[0][0]) ) {
+            if(a->verbose) printf("GETXFAVG matches beam_124\n");
+        } else if( !matrix_equal(&T_tmp[0][0], &beam_234[0][0]) ) {
+            if(a->verbose) printf("GETXFAVG matches beam_234\n");
+        } else {
+            fprintf(stderr, "GETXFAVG does not match known beam matrix - confirm this is correct - bailing out\n");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/// Days from 1970-01-01 to y-m-d, m running 1 to 12 - Howard Hinnant's
+/// days_from_civil, in 400-year eras beginning on 1 March
+static long
+CivilDays(long y, long m, long d)
+{
+    long       era, yoe, doy;
+
+    y -= m <= 2;
+    era = (y >= 0 ? y : y - 399) / 400;
+    yoe = y - era * 400;
+    doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+    return era * 146097 + yoe * 365 + yoe / 4 - yoe / 100 + doy - 719468;
+}
+
+/// Seconds since 1970 to the start of an AD2CP date.  Nortek counts the
+/// year from 1900 and the month from 0 (January) - struct tm's fields -
+/// and months past 11 carry into the year, as they do in timegm().
+static long
+DateSeconds(int year, int month, int day)
+{
+    return CivilDays(1900L + year + month / 12, month % 12 + 1, day) * 86400;
+}
+
+/// Appends one echo, burst or average data record of sz bytes, already
+/// copied to a->rec
+/// \return 0, or -1 if there is no memory for it
+static int
+Record(Ad2cp *a, int id, size_t sz)
+{
+    OutputData3_t  *ptr = (OutputData3_t *) a->rec;
+    double          scale;
+    double         *T = NULL;
+    short          *hVel;
+    unsigned short *hEcho;
+    unsigned char  *cAmp;
+    unsigned char  *cCorr;
+    long            date;
+    int             i, j, nb, nc, ncopy;
+    int             hasAmp = 0, hasCorr = 0;
+    size_t          need, at;
+
+    // the first data record sets the shape of everything
+    if (a->count == 0) {
+        a->mode = id == 0x1c ? 0x1c : 0x15;
+        if (id == 0x1c) {
+            a->num_cells = ptr -> echo_cells;
+            a->num_beams = 1;
+        }
+        else {
+            a->num_cells = ptr -> beams_cy_cells.numCells;
+            a->num_beams = ptr -> beams_cy_cells.numBeams;
+            a->nout = a->num_beams == 4 ? 4 : 3;
+            a->ampIncluded = ptr -> headconfig.ampIncluded;
+            a->corrIncluded = ptr -> headconfig.corrIncluded;
+        }
+        if(a->verbose) printf("%d cells x %d beams, amp %d corr %d\n",
+                              a->num_cells, a->num_beams, a->ampIncluded, a->corrIncluded);
+    }
+    else if ((id == 0x1c) != (a->mode == 0x1c)) {
+        if (a->mixed++ == 0)
+            fprintf(stderr, "WARNING - %s records mixed with %s records - skipping them\n",
+                    id == 0x1c ? "echo" : "velocity", a->mode == 0x1c ? "echo" : "velocity");
+        return 0;
+    }
+
+    // this record's own layout, which must fit in what was read
+    if (id == 0x1c) {
+        nc = ptr -> echo_cells;
+        nb = 1;
+        need = 2 * nc;
+    }
+    else {
+        nc = ptr -> beams_cy_cells.numCells;
+        nb = ptr -> beams_cy_cells.numBeams;
+        hasAmp = ptr -> headconfig.ampIncluded;
+        hasCorr = ptr -> headconfig.corrIncluded;
+        need = (size_t) nb * nc * (2 + hasAmp + hasCorr);
+    }
+    if (offsetof(OutputData3_t, data) + need > sz) {
+        if (a->tooShort++ == 0)
+            fprintf(stderr, "WARNING - %zu byte record too short for %d cells x %d beams - skipping\n",
+                    sz, nc, nb);
+        return 0;
+    }
+    if (nc != a->num_cells || (id != 0x1c && nb != a->num_beams)) {
+        if (a->reshaped++ == 0)
+            fprintf(stderr, "WARNING - ensemble %d is %d cells x %d beams, not %d x %d - fitting it\n",
+                    a->count, nc, nb, a->num_cells, a->num_beams);
+    }
+
+    a->cellSize = ptr -> cellSize / 1000.; //mm - pg62 N3015-007-Integrators-Guild-AD2CP.pdf
+    a->blanking = ptr -> blanking / 100.;  //cm - pg62 N3015-007-Integrators-Guild-AD2CP.pdf
+
+    scale = pow(10.0, ptr -> velocityScaling);
+
+    if (a->count == a->cap && Grow(a))
+        return -1;
+
+    a->pressure[a->count]    = ptr -> pressure*0.001;
+    a->temperature[a->count] = ptr -> temperature*0.01;
+    a->heading[a->count]     = ptr -> heading*0.01;
+    a->pitch[a->count]       = ptr -> pitch*0.01;
+    a->roll[a->count]        = ptr -> roll*0.01;
+    a->magX[a->count]        = ptr -> magnHxHyHz[0];
+    a->magY[a->count]        = ptr -> magnHxHyHz[1];
+    a->magZ[a->count]        = ptr -> magnHxHyHz[2];
+
+    // a run of ensembles keeps its date until midnight
+    date = ptr -> year << 16 | ptr -> month << 8 | ptr -> day;
+    if (date != a->date) {
+        a->date = date;
+        a->dateSeconds = DateSeconds(ptr -> year, ptr -> month, ptr -> day);
+    }
+    a->t[a->count] = a->dateSeconds + ptr -> hour * 3600L + ptr -> minute * 60 + ptr -> second
+        + ptr -> microSeconds100/1e4;
+
+    if(  ptr -> DataSetDescription4bit.beamData1 == 1 && ptr -> DataSetDescription4bit.beamData2 == 2
+         && ptr -> DataSetDescription4bit.beamData3 == 4 && ptr -> DataSetDescription4bit.beamData4 == 0) {
+        if(a->verbose) printf("Using beam_124 transformation\n");
+        T = &beam_124[0][0];
+    } else if ( ptr -> DataSetDescription4bit.beamData1 == 2 && ptr -> DataSetDescription4bit.beamData2 == 3
+                && ptr -> DataSetDescription4bit.beamData3 == 4 && ptr -> DataSetDescription4bit.beamData4 == 0) {
+        if(a->verbose) printf("Using beam_234 transformation\n");
+        T = &beam_234[0][0];
+    } else {
+        if (nb == 3) {
+            fprintf(stderr, "WARNING - unknown beam configuration %d:%d:%d:%d - using identity matrix\n",
+                    ptr -> DataSetDescription4bit.beamData1, ptr -> DataSetDescription4bit.beamData2,
+                    ptr -> DataSetDescription4bit.beamData3, ptr -> DataSetDescription4bit.beamData4 );
+            T = &beam_ident[0][0];
+        } else {
+            if(a->verbose) printf("num_beams:%d - no transformations being applied\n", nb);
+        }
+    }
+
+    // column count of each matrix; cells (and beams) beyond
+    // this record's are zero
+    at = (size_t) a->count * a->num_cells;
+    ncopy = nc < a->num_cells ? nc : a->num_cells;
+    if (id == 0x15 || id == 0x16) {
+        hVel = (short *) ptr -> data;
+        cAmp = ptr -> data + 2*nc*nb;
+        cCorr = cAmp + (hasAmp ? nc*nb : 0);
+        for (j = 0 ; j < a->nout ; j++) {
+            memset(a->beamv[j] + at, 0, a->num_cells * sizeof(double));
+            if (a->ampIncluded)
+                memset(a->amp[j] + at, 0, a->num_cells);
+            if (a->corrIncluded)
+                memset(a->corr[j] + at, 0, a->num_cells);
+        }
+        if (nb == 3) {
+            xyz(hVel, nc, ncopy, scale, T,
+                a->beamv[0] + at, a->beamv[1] + at, a->beamv[2] + at);
+        }
+        for (i = 0 ; i < ncopy ; i ++) {
+            if (nb != 3) {
+                for (j = 0 ; j < nb && j < a->nout ; j ++) {
+                    a->beamv[j][at + i] = hVel[j*nc + i];
+                }
+            }
+            for (j = 0 ; a->ampIncluded && hasAmp && j < nb && j < a->nout ; j ++) {
+                a->amp[j][at + i] = cAmp[j*nc + i];
+            }
+            for (j = 0 ; a->corrIncluded && hasCorr && j < nb && j < a->nout ; j ++) {
+                a->corr[j][at + i] = cCorr[j*nc + i];
+            }
+        }
+    }
+    else if (id == 0x1c) {
+        a->power[a->count] = ptr -> powerLevel;
+        a->beamN[a->count] = ptr -> DataSetDescription4bit.beamData1;
+        hEcho = (unsigned short *) ptr -> data;
+        if( a->verbose ) printf("nc = %d\n", nc);
+        for (i = 0 ; i < ncopy ; i++) {
+            a->echo[at + i] = hEcho[i] * 0.01;
+        }
+        for ( ; i < a->num_cells ; i++) {
+            a->echo[at + i] = 0;
+        }
+    }
+    a->count ++;
+    if( a->verbose ) printf("count = %d\n", a->count);
+    return 0;
+}
+
+/// Nortek's checksum - 0xb58c plus the little-endian 16 bit words of p,
+/// an odd last byte counting as the high byte of one more
+unsigned short
+Ad2cpChecksum(const unsigned char *p, size_t n)
+{
+    unsigned int  sum = 0xb58c;
+    size_t        i;
+
+    for (i = 0 ; i + 1 < n ; i += 2)
+        sum += p[i] | p[i + 1] << 8;
+    if (i < n)
+        sum += p[i] << 8;
+    return sum & 0xffff;
+}
+
+void
+Ad2cpScanInit(Ad2cpScan *s, const unsigned char *p, size_t len)
+{
+    memset(s, 0, sizeof(Ad2cpScan));
+    s->p = p;
+    s->end = p + len;
+}
+
+/// Finds the next frame whose header and data checksums hold.  Sync
+/// bytes are found with memchr().  When a header fails its checksum, or
+/// its data fails or runs past the end of the buffer, the search resumes
+/// at the byte after that sync.  Bytes may have been lost from inside
+/// the frame, so the next good frame can start within its claimed size.
+/// \return 1 with *f filled in, 0 at the end of the buffer
+int
+Ad2cpNextFrame(Ad2cpScan *s, Ad2cpFrame *f)
+{
+    const unsigned char *h;
+    size_t               left, hsz, dsz;
+
+    while (s->p < s->end) {
+        if ((h = memchr(s->p, 0xa5, s->end - s->p)) == NULL) {
+            s->skipped += s->end - s->p;
+            s->p = s->end;
+            break;
+        }
+        s->skipped += h - s->p;
+        s->p = h + 1;
+
+        left = s->end - h;
+        if (left < 2 || (h[1] != 10 && h[1] != 12)) {
+            s->skipped ++;
+            continue;
+        }
+        hsz = h[1];
+        if (left < hsz) {
+            s->dropped ++;
+            continue;
+        }
+        if (Ad2cpChecksum(h, hsz - 2) != (h[hsz - 2] | h[hsz - 1] << 8)) {
+            s->corrupt ++;
+            continue;
+        }
+
+        // 16 bit data size, or 32 in the long form
+        dsz = h[4] | h[5] << 8;
+        if (hsz == 12)
+            dsz |= (size_t) h[6] << 16 | (size_t) h[7] << 24;
+        if (left - hsz < dsz) {
+            s->dropped ++;
+            continue;
+        }
+        if (Ad2cpChecksum(h + hsz, dsz) != (h[hsz - 4] | h[hsz - 3] << 8)) {
+            s->corrupt ++;
+            continue;
+        }
+
+        f->id = h[2];
+        f->family = h[3];
+        f->data = h + hsz;
+        f->size = dsz;
+        s->p = h + hsz + dsz;
+        s->frames ++;
+        return 1;
+    }
+    return 0;
+}
+
+/// Decodes the frames in p, appending to whatever a already holds
+/// \return 0, or -1 on a transformation we do not know or no memory
+int
+Ad2cpDecode(Ad2cp *a, const unsigned char *p, size_t len)
+{
+    Ad2cpScan      s;
+    Ad2cpFrame     f;
+    unsigned char *q;
+    int            r = 0;
+
+    Ad2cpScanInit(&s, p, len);
+    while (r == 0 && Ad2cpNextFrame(&s, &f)) {
+        if (f.size >= a->reccap) {
+            if ((q = realloc(a->rec, f.size + 1)) == NULL) {
+                fprintf(stderr, "libad2cp: out of memory for a %zu byte record\n", f.size);
+                r = -1;
+                break;
+            }
+            a->rec = q;
+            a->reccap = f.size + 1;
+        }
+        memcpy(a->rec, f.data, f.size);
+        a->rec[f.size] = '\0';
+
+        if (f.id == 0xA0) {
+            char *str = strstr((char *) a->rec, "GETXFAVG");
+
+            if (str && Xfavg(a, str))
+                r = -1;
+        }
+        else if (f.id == 0x1c || f.id == 0x15 || f.id == 0x16) { // echo, burst data or average data record
+            r = Record(a, f.id, f.size);
+        }
+    }
+
+    a->frames += s.frames;
+    a->corrupt += s.corrupt;
+    a->dropped += s.dropped;
+    a->skipped += s.skipped;
+    return r;
+}
+
+/// Frames decoded, and dropped for failed checksums or running short,
+/// bytes skipped, and records too short for their own shape, over
+/// everything a has been given
+void
+Ad2cpStats(Ad2cp *a, long *frames, long *corrupt, long *dropped, long *skipped,
+           long *tooShort)
+{
+    *frames = a->frames;
+    *corrupt = a->corrupt;
+    *dropped = a->dropped;
+    *skipped = a->skipped;
+    *tooShort = a->tooShort;
+}
+
+/// \return 0, 1 if name cannot be opened, or -1 as Ad2cpDecode
+int
+Ad2cpDecodeFile(Ad2cp *a, const char *name)
+{
+    unsigned char *base;
+    size_t         len;
+    int            mapped, r;
+
+    if ((base = MapFile(name, &len, &mapped)) == NULL)
+        return 1;
+    r = Ad2cpDecode(a, base, len);
+    UnmapFile(base, len, mapped);
+    return r;
+}
+
+/// Appends what b holds to a, as though b's input had followed a's.  b
+/// must have started out fresh from Ad2cpNew(); a handle per input can
+/// then decode on its own thread.  If a holds no ensembles yet the two
+/// trade places, so the first input's columns are never copied.
+/// \return 0 - b may be freed either way - or 1 if b's ensembles are
+/// not shaped as a's, when its input has to be decoded into a instead
+/// to be mixed or fitted as it would have been, or -1 on no memory
+int
+Ad2cpAppend(Ad2cp *a, Ad2cp *b)
+{
+    Ad2cp      tmp;
+    int        j, nc;
+
+    if (a->count == 0) {
+        tmp = *a;
+        *a = *b;
+        *b = tmp;
+        a->verbose = b->verbose;
+    }
+    else if (b->count) {
+        if (b->mode != a->mode || b->num_cells != a->num_cells
+            || (a->mode != 0x1c && (b->num_beams != a->num_beams
+                                    || b->ampIncluded != a->ampIncluded
+                                    || b->corrIncluded != a->corrIncluded)))
+            return 1;
+
+        if (a->count + b->count > a->cap && Room(a, a->count + b->count))
+            return -1;
+
+#define APPEND(x, w) \
+    memcpy(a->x + (size_t) a->count * (w), b->x, sizeof(*a->x) * (w) * b->count)
+
+        nc = a->num_cells;
+        if (a->mode == 0x1c) {
+            APPEND(echo, nc);
+            APPEND(beamN, 1);
+            APPEND(power, 1);
+        }
+        else {
+            for (j = 0 ; j < a->nout ; j++) {
+                APPEND(beamv[j], nc);
+                if (a->corrIncluded)
+                    APPEND(corr[j], nc);
+                if (a->ampIncluded)
+                    APPEND(amp[j], nc);
+            }
+        }
+        APPEND(t, 1);
+        APPEND(pressure, 1);
+        APPEND(pitch, 1);
+        APPEND(roll, 1);
+        APPEND(heading, 1);
+        APPEND(temperature, 1);
+        APPEND(magX, 1);
+        APPEND(magY, 1);
+        APPEND(magZ, 1);
+
+#undef APPEND
+
+        a->count += b->count;
+        a->cellSize = b->cellSize;
+        a->blanking = b->blanking;
+    }
+
+    a->mixed += b->mixed;
+    a->reshaped += b->reshaped;
+    a->tooShort += b->tooShort;
+    a->frames += b->frames;
+    a->corrupt += b->corrupt;
+    a->dropped += b->dropped;
+    a->skipped += b->skipped;
+    return 0;
+}
+
+/// Fills v with the variables decoded so far, in MAT-file order
+/// \return how many
+int
+Ad2cpVars(Ad2cp *a, Ad2cpVar *v)
+{
+    static const char *vel4[] = { "vel1", "vel2", "vel3", "vel4" };
+    static const char *velXYZ[] = { "velX", "velY", "velZ" };
+    static const char *corrs[] = { "corr1", "corr2", "corr3", "corr4" };
+    static const char *amps[] = { "amp1", "amp2", "amp3", "amp4" };
+    int                n = 0, j, nb;
+
+#define VAR(nm, p, r, c, k) \
+    (v[n].name = (nm), v[n].data = (p), v[n].nr = (r), v[n].nc = (c), v[n].kind = (k), n++)
+
+    if (a->mode == 0x1c) {
+        VAR("echo", a->echo, a->num_cells, a->count, AD2CP_DOUBLE);
+        VAR("beam", a->beamN, a->count, 1, AD2CP_INT16);
+        VAR("power", a->power, a->count, 1, AD2CP_INT16);
+    }
+    else {
+        nb = a->num_beams == 4 ? 4 : 3;
+        for (j = 0 ; j < nb ; j++)
+            VAR(nb == 4 ? vel4[j] : velXYZ[j], a->beamv[j], a->num_cells, a->count, AD2CP_DOUBLE);
+        for (j = 0 ; a->corrIncluded && j < nb ; j++)
+            VAR(corrs[j], a->corr[j], a->num_cells, a->count, AD2CP_UINT8);
+        for (j = 0 ; a->ampIncluded && j < nb ; j++)
+            VAR(amps[j], a->amp[j], a->num_cells, a->count, AD2CP_UINT8);
+    }
+    VAR("pressure", a->pressure, a->count, 1, AD2CP_DOUBLE);
+    VAR("temperature", a->temperature, a->count, 1, AD2CP_DOUBLE);
+    VAR("heading", a->heading, a->count, 1, AD2CP_DOUBLE);
+    VAR("pitch", a->pitch, a->count, 1, AD2CP_DOUBLE);
+    VAR("roll", a->roll, a->count, 1, AD2CP_DOUBLE);
+
+    VAR("magX", a->magX, a->count, 1, AD2CP_INT16);
+    VAR("magY", a->magY, a->count, 1, AD2CP_INT16);
+    VAR("magZ", a->magZ, a->count, 1, AD2CP_INT16);
+
+    VAR("time", a->t, a->count, 1, AD2CP_DOUBLE);
+
+    VAR("cellSize", &a->cellSize, 1, 1, AD2CP_DOUBLE);
+    VAR("blanking", &a->blanking, 1, 1, AD2CP_DOUBLE);
+
+#undef VAR
+    return n;
+}
+
+/// Writes a byte matrix as uint8, or as the int16 level 4 files
+/// have always carried
+/// \return 0, or -1 on no memory or a write error
+static int
+ByteMatrix(unsigned char *a, int nr, int nc, char *name, MATfile *mf)
+{
+    short     *w;
+    size_t     i, n = (size_t) nr * nc;
+    int        r;
+
+    if (mf->v5)
+        return MatlabByteMatrix(a, nr, nc, name, mf);
+    if ((w = malloc(sizeof(short) * (n ? n : 1))) == NULL) {
+        fprintf(stderr, "libad2cp: out of memory writing %s\n", name);
+        return -1;
+    }
+    for (i = 0 ; i < n ; i++)
+        w[i] = a[i];
+    r = MatlabMatrix(w, nr, nc, name, mf);
+    free(w);
+    return r;
+}
+
+/// Writes everything decoded to fname, as level 5 (deflated, integer
+/// classes kept) if v5 is set
+/// \return 0, or -1 if the file cannot be (all) written
+int
+Ad2cpWriteMatlab(Ad2cp *a, const char *fname, int v5)
+{
+    Ad2cpVar   v[AD2CP_MAXVARS];
+    MATfile    mf;
+    FILE      *out;
+    int        i, n, bad = 0;
+
+    if ((out = fopen(fname, "wb")) == NULL) {
+        perror(fname);
+        return -1;
+    }
+
+    MatlabOpen(&mf, out, v5);
+
+    n = Ad2cpVars(a, v);
+    for (i = 0 ; i < n && !bad ; i++) {
+        switch (v[i].kind) {
+        case AD2CP_DOUBLE:
+            bad = MatlabDoubleMatrix(v[i].data, v[i].nr, v[i].nc, (char *) v[i].name, &mf);
+            break;
+        case AD2CP_INT16:
+            bad = MatlabMatrix(v[i].data, v[i].nr, v[i].nc, (char *) v[i].name, &mf);
+            break;
+        case AD2CP_UINT8:
+            bad = ByteMatrix(v[i].data, v[i].nr, v[i].nc, (char *) v[i].name, &mf);
+            break;
+        }
+    }
+
+    if (fclose(out) != 0 || bad)
+        return -1;
+    return 0;
+}
+
+#ifdef XYZ_BENCH
+// gcc -O2 -DXYZ_BENCH -o xyzbench ad2cp.c matfile.c -lm -lz
+//
+// Checks every kernel against xyz_scalar over each cell count to 300
+// and the three matrices, then times them on a long run of ensembles.
+
+/// Reference - the per-cell, per-beam loop
+static void
+xyz_scalar(const short *hVel, int stride, int n, double scale,
+           const double *T, double *x, double *y, double *z)
+{
+    double  V123[3], Vxyz[3];
+    double *out[3] = { x, y, z };
+    int     i, j, k;
+
+    for (i = 0 ; i < n ; i ++) {
+        for (j = 0 ; j < 3 ; j ++) {
+            V123[j] = scale*hVel[j*stride + i];
+        }
+        for (j = 0 ; j < 3 ; j ++) {
+            Vxyz[j] = 0;
+            for (k = 0 ; k < 3 ; k ++) {
+                Vxyz[j] += *(T + j * 3 + k) * V123[k];
+            }
+            out[j][i] = Vxyz[j];
+        }
+    }
+}
+
+static double
+now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int
+main(int argc, char *argv[])
+{
+    static struct {
+        char     *name;
+        xyz_fn_t  fn;
+    } variants[] = {
+        { "scalar", xyz_scalar },
+        { "soa",    xyz_soa },
+#ifdef XYZ_AVX2
+        { "avx2",   NULL },
+#endif
+    };
+    double        *mats[3] = { &beam_124[0][0], &beam_234[0][0], &beam_ident[0][0] };
+    int            nvariants = sizeof(variants) / sizeof(variants[0]);
+    int            nens = argc > 1 ? atoi(argv[1]) : 100000;
+    int            cells = argc > 2 ? atoi(argv[2]) : 128;
+    double         scale = pow(10.0, -3);
+    short         *h;
+    double        *ref, *out;
+    double         t;
+    int            n, m, e, v, i;
+    int            bad = 0;
+
+#ifdef XYZ_AVX2
+    if (xyz_select() == xyz_avx2)
+        variants[nvariants - 1].fn = xyz_avx2;
+    else
+        nvariants --;
+#endif
+
+    h = malloc(sizeof(short) * 3 * 300);
+    ref = malloc(sizeof(double) * 3 * 300);
+    out = malloc(sizeof(double) * 3 * 300);
+    srandom(1);
+    for (i = 0 ; i < 3 * 300 ; i++)
+        h[i] = random();
+
+    for (n = 0 ; n <= 300 ; n++) {
+        for (m = 0 ; m < 3 ; m++) {
+            xyz_scalar(h, n, n, scale, mats[m], ref, ref + n, ref + 2*n);
+            for (v = 1 ; v < nvariants ; v++) {
+                variants[v].fn(h, n, n, scale, mats[m], out, out + n, out + 2*n);
+                if (memcmp(ref, out, sizeof(double) * 3 * n)) {
+                    printf("%s: %d cells, matrix %d differs\n", variants[v].name, n, m);
+                    bad = 1;
+                }
+            }
+        }
+    }
+
+    free(h);
+    free(ref);
+    free(out);
+    h = malloc(sizeof(short) * 3 * cells * (size_t) nens);
+    out = malloc(sizeof(double) * 3 * cells * (size_t) nens);
+    for (i = 0 ; i < 3 * cells * nens ; i++)
+        h[i] = random();
+
+    for (v = 0 ; v < nvariants ; v++) {
+        t = now();
+        for (e = 0 ; e < nens ; e++)
+            variants[v].fn(h + (size_t) e * 3 * cells, cells, cells, scale, mats[0],
+                           out + (size_t) e * cells,
+                           out + ((size_t) nens + e) * cells,
+                           out + (2 * (size_t) nens + e) * cells);
+        t = now() - t;
+        printf("%-8s %7.1f M cells/s%s\n", variants[v].name, (double) nens * cells / t / 1e6,
+               variants[v].fn == xyz_select() ? " (selected)" : "");
+    }
+
+    printf("%s\n", bad ? "FAILED" : "all kernels agree");
+    return bad;
+}
+#endif
+
+#ifdef TIME_CHECK
+// gcc -DTIME_CHECK -o timecheck ad2cp.c matfile.c -lm -lz
+//
+// Checks ensemble times against timegm() over every year and month an
+// AD2CP record can carry, and a run of known ensembles through Record().
+
+int
+main(void)
+{
+    static struct {
+        int     year, month, day, hour, minute, second, us100;
+        double  t;
+    } known[] = {
+        { 99, 11, 31, 23, 59, 59, 9999, 946684799.9999 },  // 1999-12-31
+        { 100, 0, 1, 0, 0, 0, 0, 946684800 },              // 2000-01-01
+        { 123, 5, 15, 12, 34, 56, 5000, 1686832496.5 },    // 2023-06-15
+        { 123, 5, 15, 23, 59, 59, 0, 1686873599 },
+        { 123, 5, 16, 0, 0, 0, 0, 1686873600 },
+        { 124, 1, 29, 0, 0, 0, 0, 1709164800 },            // 2024-02-29
+        { 124, 0, 1, 0, 0, 0, 0, 1704067200 },             // 2024-01-01
+    };
+    OutputData3_t  rec;
+    struct tm      tm;
+    Ad2cp         *a;
+    int            y, m, d, i, bad = 0;
+
+    for (y = 0 ; y < 256 ; y++) {
+        for (m = 0 ; m < 256 ; m++) {
+            for (d = 0 ; d < 34 ; d++) {
+                memset(&tm, 0, sizeof(tm));
+                tm.tm_year = y;
+                tm.tm_mon = m;
+                tm.tm_mday = d;
+                if (timegm(&tm) != DateSeconds(y, m, d)) {
+                    printf("%d/%d/%d: %ld, timegm %ld\n", y, m, d,
+                           DateSeconds(y, m, d), (long) timegm(&tm));
+                    bad = 1;
+                }
+            }
+        }
+    }
+
+    a = Ad2cpNew(0);
+    memset(&rec, 0, sizeof(rec));
+    rec.beams_cy_cells.numBeams = 3;
+    rec.DataSetDescription4bit.beamData1 = 1;
+    rec.DataSetDescription4bit.beamData2 = 2;
+    rec.DataSetDescription4bit.beamData3 = 4;
+    for (i = 0 ; i < (int) (sizeof(known) / sizeof(known[0])) ; i++) {
+        rec.year = known[i].year;
+        rec.month = known[i].month;
+        rec.day = known[i].day;
+        rec.hour = known[i].hour;
+        rec.minute = known[i].minute;
+        rec.second = known[i].second;
+        rec.microSeconds100 = known[i].us100;
+        memcpy(a->rec, &rec, sizeof(rec));
+        Record(a, 0x16, sizeof(rec));
+        if (a->t[i] != known[i].t) {
+            printf("ensemble %d: %.4f, not %.4f\n", i, a->t[i], known[i].t);
+            bad = 1;
+        }
+    }
+    Ad2cpFree(a);
+
+    printf("%s\n", bad ? "FAILED" : "times agree");
+    return bad;
+}
+#endif
@@ -0,0 +1,112 @@
+//
+// Copyright (c) 2018, 2021, 2023 University of Washington.  All rights reserved.
+//
+// This file contains proprietary information and remains the 
+// unpublished property of the University of Washington. Use, disclosure,
+// or reproduction is prohibited.
+//
+
+// libad2cp - decodes Nortek AD2CP average, burst and echo records into
+// contiguous per-ensemble columns, matrices held one ensemble (column)
+// after another.  ad2cpMAT is a thin driver around it and cp_ext.py
+// reaches it in-process through ad2cp.py (ctypes).  Nothing here exits
+// or writes to stdout unless verbose is set; failures come back as -1.
+
+# ifndef AD2CP_H
+# define AD2CP_H
+
+# include <stddef.h>
+
+typedef struct {
+    int             verbose;
+    int             count;        // ensembles decoded
+    int             cap;          // ensembles there is room for
+    int             mode;         // 0x1c echo, 0x15 velocity, 0 nothing yet
+    int             num_beams;
+    int             num_cells;
+    int             nout;         // velocity (amp, corr) beams stored
+    int             ampIncluded;
+    int             corrIncluded;
+    int             mixed;        // records skipped for the wrong mode
+    int             reshaped;     // records fitted to the first one's shape
+    int             tooShort;     // records too short for their cells and beams
+    long            frames;       // frames whose checksums held
+    long            corrupt;      // frames failing a checksum
+    long            dropped;      // frames running past the data
+    long            skipped;      // bytes between frames
+    long            date;         // last record's year, month and day
+    long            dateSeconds;  // and its midnight, seconds since 1970
+
+    double          cellSize;
+    double          blanking;
+
+    double         *beamv[4];
+    unsigned char  *corr[4];
+    unsigned char  *amp[4];
+    double         *echo;
+    short          *beamN;
+    short          *power;
+    double         *temperature;
+    double         *pressure;
+    double         *heading;
+    double         *roll;
+    double         *pitch;
+    double         *t;
+    short          *magX;
+    short          *magY;
+    short          *magZ;
+
+    unsigned char  *rec;          // aligned copy of the record in hand
+    size_t          reccap;
+} Ad2cp;
+
+/// Frame scanner state - counts as in Ad2cp
+typedef struct {
+    const unsigned char *p;
+    const unsigned char *end;
+    long                 frames;
+    long                 corrupt;
+    long                 dropped;
+    long                 skipped;
+} Ad2cpScan;
+
+/// One checksummed frame, its data still in the scanned buffer
+typedef struct {
+    int                  id;
+    int                  family;
+    const unsigned char *data;
+    size_t               size;
+} Ad2cpFrame;
+
+/// Element types of Ad2cpVar
+enum { AD2CP_DOUBLE, AD2CP_INT16, AD2CP_UINT8 };
+
+/// One output variable - nc columns of nr values
+typedef struct {
+    const char *name;
+    void       *data;
+    int         nr;
+    int         nc;
+    int         kind;
+} Ad2cpVar;
+
+# define AD2CP_MAXVARS 32
+
+Ad2cp *Ad2cpNew (int verbose);
+void   Ad2cpFree (Ad2cp *a);
+int    Ad2cpDecode (Ad2cp *a, const unsigned char *p, size_t len);
+int    Ad2cpDecodeFile (Ad2cp *a, const char *name);
+int    Ad2cpAppend (Ad2cp *a, Ad2cp *b);
+int    Ad2cpVars (Ad2cp *a, Ad2cpVar *v);
+void   Ad2cpStats (Ad2cp *a, long *frames, long *corrupt, long *dropped, long *skipped,
+                   long *tooShort);
+int    Ad2cpWriteMatlab (Ad2cp *a, const char *fname, int v5);
+
+unsigned short Ad2cpChecksum (const unsigned char *p, size_t n);
+void           Ad2cpScanInit (Ad2cpScan *s, const unsigned char *p, size_t len);
+int            Ad2cpNextFrame (Ad2cpScan *s, Ad2cpFrame *f);
+
+unsigned char *MapFile (const char *name, size_t *len, int *mapped);
+void           UnmapFile (unsigned char *p, size_t len, int mapped);
+
+# endif
@@ -0,0 +1,201 @@
+#! /usr/bin/env python
+# -*- python-fmt -*-
+
+##
+## Copyright (c) 2023 by University of Washington.  All rights reserved.
+##
+## This file contains proprietary information and remains the
+## unpublished property of the University of Washington. Use, disclosure,
+## or reproduction is prohibited except as permitted by express written
+## license agreement with the University of Washington.
+##
+## THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+## AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+## IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+## ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+## LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+## CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+## SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+## INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+## CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+## ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+## POSSIBILITY OF SUCH DAMAGE.
+##
+
+"""
+In-process access to libad2cp (Sensors/ad2cp.c) - the decoder behind ad2cpMAT.
+
+Not a sensor extension; cp_ext.py loads it to write the same .mat file
+ad2cpMAT would without a subprocess, and decode() returns the same
+variables straight as numpy arrays.  Callers should treat available() == False (library
+not built, or not loadable) as a cue to fall back to the ad2cpMAT binary.
+"""
+
+import ctypes
+import os
+
+import numpy as np
+
+from BaseLog import log_error, log_info, log_warning
+
+# Element kinds - matches the AD2CP_* enum in ad2cp.h
+_dtypes = {0: np.float64, 1: np.int16, 2: np.uint8}
+
+_max_vars = 32  # AD2CP_MAXVARS
+
+_lib = None
+_lib_tried = False
+
+
+class _Var(ctypes.Structure):
+    """Mirrors Ad2cpVar"""
+
+    _fields_ = [
+        ("name", ctypes.c_char_p),
+        ("data", ctypes.c_void_p),
+        ("nr", ctypes.c_int),
+        ("nc", ctypes.c_int),
+        ("kind", ctypes.c_int),
+    ]
+
+
+def _load():
+    """Loads libad2cp.so from next to this file, once"""
+    global _lib, _lib_tried  # pylint: disable=global-statement
+
+    if _lib_tried:
+        return _lib
+    _lib_tried = True
+
+    lib_name = library_name()
+    if not os.path.exists(lib_name):
+        log_info(f"{lib_name} not built - using ad2cpMAT")
+        return None
+    try:
+        lib = ctypes.CDLL(lib_name)
+    except OSError:
+        log_error(f"Unable to load {lib_name} - using ad2cpMAT", "exc")
+        return None
+
+    lib.Ad2cpNew.argtypes = [ctypes.c_int]
+    lib.Ad2cpNew.restype = ctypes.c_void_p
+    lib.Ad2cpFree.argtypes = [ctypes.c_void_p]
+    lib.Ad2cpFree.restype = None
+    lib.Ad2cpDecodeFile.argtypes = [ctypes.c_void_p, ctypes.c_char_p]
+    lib.Ad2cpDecodeFile.restype = ctypes.c_int
+    lib.Ad2cpVars.argtypes = [ctypes.c_void_p, ctypes.POINTER(_Var)]
+    lib.Ad2cpVars.restype = ctypes.c_int
+    lib.Ad2cpStats.argtypes = [ctypes.c_void_p] + [ctypes.POINTER(ctypes.c_long)] * 5
+    lib.Ad2cpStats.restype = None
+    lib.Ad2cpWriteMatlab.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_int]
+    lib.Ad2cpWriteMatlab.restype = ctypes.c_int
+
+    _lib = lib
+    return _lib
+
+
+def available():
+    """True if libad2cp can be used"""
+    return _load() is not None
+
+
+def library_name():
+    """Full path of libad2cp.so"""
+    return os.path.join(os.path.dirname(os.path.abspath(__file__)), "libad2cp.so")
+
+
+def _decode_files(lib, handle, file_names):
+    """Feeds file_names to the decoder in order
+
+    Returns:
+        True - all decoded (unreadable files are skipped, as ad2cpMAT does)
+        False - decoder gave up
+    """
+    for file_name in file_names:
+        ret_val = lib.Ad2cpDecodeFile(handle, os.fsencode(file_name))
+        if ret_val > 0:
+            log_error(f"Cannot open {file_name} - skipping")
+        elif ret_val < 0:
+            log_error(f"Decoding {file_name} failed")
+            return False
+
+    frames, corrupt, dropped, skipped, too_short = (ctypes.c_long() for _ in range(5))
+    lib.Ad2cpStats(handle, frames, corrupt, dropped, skipped, too_short)
+    if corrupt.value or dropped.value or too_short.value:
+        log_warning(
+            f"{corrupt.value} corrupt and {dropped.value} cut short frames dropped, "
+            f"{skipped.value} bytes skipped, {too_short.value} records too short "
+            f"in {file_names}"
+        )
+    return True
+
+
+def decode(file_names):
+    """Decodes AD2CP files into numpy arrays
+
+    Input:
+        file_names - list of raw .ad2cp files, appended in order
+
+    Returns:
+        Dictionary shaped as loadmat() returns the ad2cpMAT output - vectors
+        (n, 1), matrices (cells, ensembles) - or None on failure
+    """
+    lib = _load()
+    if lib is None:
+        return None
+
+    handle = lib.Ad2cpNew(0)
+    if not handle:
+        log_error("Out of memory for libad2cp")
+        return None
+
+    try:
+        if not _decode_files(lib, handle, file_names):
+            return None
+        variables = (_Var * _max_vars)()
+        ret_d = {}
+        for ii in range(lib.Ad2cpVars(handle, variables)):
+            var = variables[ii]
+            dtype = _dtypes[var.kind]
+            n = var.nr * var.nc
+            if n and var.data:
+                buf = (ctypes.c_char * (n * np.dtype(dtype).itemsize)).from_address(
+                    var.data
+                )
+                # copy - the buffers go with the handle
+                data = np.frombuffer(buf, dtype=dtype, count=n).copy()
+            else:
+                data = np.zeros(n, dtype=dtype)
+            ret_d[var.name.decode()] = data.reshape((var.nr, var.nc), order="F")
+        return ret_d
+    finally:
+        lib.Ad2cpFree(handle)
+
+
+def convert(file_names, mat_file_name, compress=True):
+    """Writes the .mat file ad2cpMAT [-z] would for file_names
+
+    Returns:
+        0 - success
+        1 - failure
+    """
+    lib = _load()
+    if lib is None:
+        return 1
+
+    handle = lib.Ad2cpNew(0)
+    if not handle:
+        log_error("Out of memory for libad2cp")
+        return 1
+
+    try:
+        if not _decode_files(lib, handle, file_names):
+            return 1
+        if lib.Ad2cpWriteMatlab(
+            handle, os.fsencode(mat_file_name), 1 if compress else 0
+        ):
+            log_error(f"Unable to write {mat_file_name}")
+            return 1
+        return 0
+    finally:
+        lib.Ad2cpFree(handle)
@@ -26,6 +26,7 @@
 Current Profiles (ADCP)  basestation sensor extension
 """
 
+import hashlib
 import os
 import shutil
 
@@ -40,6 +41,16 @@ from BaseLog import log_debug, log_error, log_info
 # Globals
 cp_prefix = "cp"
 
+# In-process decoder (ad2cp.py), loaded on first use
+_ad2cp = None
+
+# Converted .mat files, named for the hash of the raw file and the converter,
+# under the mission directory
+cp_cache_dir = ".ad2cp_cache"
+
+# Converter digests, by (path, size, mtime)
+_converter_digests = {}
+
 nc_cp_data_info = "cp_data_info"
 nc_cp_cell_info = "cp_cell_info"
 
@@ -243,30 +254,49 @@ def process_data_files(
         shutil.copy(fc.full_filename(), ad2cpfile)
         processed_logger_other_files.append(ad2cpfile)
 
-        # Run the convertor to create a .mat file
-        convertor = os.path.join(
-            os.path.join(base_opts.basestation_directory, "Sensors"), "ad2cpMAT"
-        )
-        if not os.path.isfile(convertor):
-            log_error(
-                f"Convertor {convertor} does not exits - not processing {fc.full_filename()}"
-            )
-            return 1
-        if not os.access(convertor, os.X_OK):
-            log_error(
-                f"Convertor ({convertor}) is not marked as executable - not processing {fc.full_filename()}"
-            )
-            return 1
-
         matfile = fc.mk_base_engfile_name().replace(".eng", ".mat")
 
-        cmdline = f"{convertor} {fc.full_filename()} {matfile}"
-        log_info(f"Running {cmdline}")
-        try:
-            Utils.run_cmd_shell(cmdline)
-        except:
-            log_error(f"Error running {cmdline}", "exc")
-            return 1
+        ad2cp = load_ad2cp()
+        if ad2cp is not None:
+            convertor = ad2cp.library_name()
+        else:
+            convertor = os.path.join(
+                os.path.join(base_opts.basestation_directory, "Sensors"), "ad2cpMAT"
+            )
+            if not os.path.isfile(convertor):
+                log_error(
+                    f"Convertor {convertor} does not exits - not processing {fc.full_filename()}"
+                )
+                return 1
+            if not os.access(convertor, os.X_OK):
+                log_error(
+                    f"Convertor ({convertor}) is not marked as executable - not processing {fc.full_filename()}"
+                )
+                return 1
+
+        # A raw file this converter has seen before needs no decoding
+        cached = cache_name(base_opts, convertor, fc.full_filename())
+        if cached and os.path.exists(cached):
+            log_info(f"Using {cached} for {fc.full_filename()}")
+            shutil.copyfile(cached, matfile)
+        else:
+            if ad2cp is not None:
+                log_info(f"Converting {fc.full_filename()} to {matfile} in-process")
+                if ad2cp.convert([fc.full_filename()], matfile):
+                    return 1
+            else:
+                cmdline = f"{convertor} -z {fc.full_filename()} {matfile}"
+                log_info(f"Running {cmdline}")
+                try:
+                    (sts, _) = Utils.run_cmd_shell(cmdline)
+                except:
+                    log_error(f"Error running {cmdline}", "exc")
+                    return 1
+                if sts:
+                    log_error(f"Error running {cmdline} - status {sts >> 8}")
+                    return 1
+            if cached:
+                cache_store(matfile, cached)
 
         shutil.copy(matfile, fc.mk_base_engfile_name())
         processed_logger_eng_files.append(fc.mk_base_engfile_name())
@@ -274,6 +304,82 @@ def process_data_files(
     return 0
 
 
+def file_digest(file_name, digest=None):
+    """Adds the contents of file_name to a sha256 digest
+
+    Returns:
+        The digest
+    """
+    if digest is None:
+        digest = hashlib.sha256()
+    with open(file_name, "rb") as fi:
+        for chunk in iter(lambda: fi.read(1 << 20), b""):
+            digest.update(chunk)
+    return digest
+
+
+def cache_name(base_opts, convertor, raw_file_name):
+    """Names the cached conversion of raw_file_name by convertor
+
+    The name is the hash of the converter binary (or library) and the raw
+    file, so a rebuilt converter or changed data misses the cache.
+
+    Returns:
+        Full path of the cache entry, which may not exist yet
+        None - no cache available
+    """
+    if not base_opts.mission_dir:
+        return None
+    try:
+        st = os.stat(convertor)
+        key = (convertor, st.st_size, st.st_mtime_ns)
+        if key not in _converter_digests:
+            _converter_digests[key] = file_digest(convertor).hexdigest()
+        digest = hashlib.sha256(_converter_digests[key].encode())
+        file_digest(raw_file_name, digest)
+    except OSError:
+        log_error(f"Unable to hash {convertor} and {raw_file_name}", "exc")
+        return None
+    return os.path.join(
+        base_opts.mission_dir, cp_cache_dir, f"{digest.hexdigest()}.mat"
+    )
+
+
+def cache_store(matfile, cached):
+    """Copies a fresh conversion into the cache, replacing any entry whole"""
+    tmp_name = f"{cached}.{os.getpid()}"
+    try:
+        os.makedirs(os.path.dirname(cached), exist_ok=True)
+        shutil.copyfile(matfile, tmp_name)
+        os.replace(tmp_name, cached)
+    except OSError:
+        log_error(f"Unable to cache {matfile} as {cached}", "exc")
+        try:
+            os.unlink(tmp_name)
+        except OSError:
+            pass
+
+
+def load_ad2cp():
+    """Loads the libad2cp binding that sits next to this file
+
+    Returns:
+        The module, if its library is usable
+        None - fall back to the ad2cpMAT binary and loadmat
+    """
+    global _ad2cp  # pylint: disable=global-statement
+
+    if _ad2cp is None:
+        _ad2cp = Utils.loadmodule(
+            os.path.join(os.path.dirname(os.path.abspath(__file__)), "ad2cp.py")
+        )
+        if _ad2cp is None:
+            _ad2cp = False
+    if _ad2cp and _ad2cp.available():
+        return _ad2cp
+    return None
+
+
 # pylint: disable=unused-argument
 def eng_file_reader(eng_files, nc_info_d, calib_consts):
     """Reads the eng files for adcp instruments
@@ -295,6 +401,9 @@ def eng_file_reader(eng_files, nc_info_d, calib_consts):
         # cast = fn["cast"]
         filename = fn["file_name"]
 
+        # The eng file is the conversion process_data_files() made (or
+        # took from the cache) - reading it spares decoding the raw file
+        # again on every reprocess
         try:
             mf = loadmat(filename)
         except:
@@ -0,0 +1,281 @@
+//
+// Copyright (c) 2018, 2023 University of Washington.  All rights reserved.
+//
+// This file contains proprietary information and remains the 
+// unpublished property of the University of Washington. Use, disclosure,
+// or reproduction is prohibited.
+//
+
+# include <stdio.h>
+# include <stdlib.h>
+# include <string.h>
+# include <time.h>
+# include <errno.h>
+# include <unistd.h>
+# include <sys/uio.h>
+# include <zlib.h>
+# include "matfile.h"
+
+// v5 data types and array classes
+# define miINT8        1
+# define miUINT8       2
+# define miINT16       3
+# define miUINT16      4
+# define miINT32       5
+# define miUINT32      6
+# define miDOUBLE      9
+# define miMATRIX     14
+# define miCOMPRESSED 15
+
+# define mxDOUBLE_CLASS  6
+# define mxUINT8_CLASS   9
+# define mxINT16_CLASS  10
+# define mxUINT16_CLASS 11
+
+# define PAD8(n) (((n) + 7) & ~(size_t) 7)
+
+/// How each element kind is stored in either format
+static struct {
+    int     precision;   // level 4 P digit
+    size_t  size;
+    int     mi;
+    int     mx;
+} kinds[] = {
+    { 0, sizeof(double),         miDOUBLE, mxDOUBLE_CLASS },
+    { 3, sizeof(short),          miINT16,  mxINT16_CLASS },
+    { 4, sizeof(unsigned short), miUINT16, mxUINT16_CLASS },
+    { 5, sizeof(unsigned char),  miUINT8,  mxUINT8_CLASS },
+};
+
+enum { KIND_DOUBLE, KIND_INT16, KIND_UINT16, KIND_UINT8 };
+
+static int 
+architecture ( )
+{
+    int  x = 1;
+
+    if (*((char *) &x) == 1)
+        return 0;
+    else
+        return 1;
+}
+
+/// Writes all of iov to fd, picking up after short writes
+/// \return 0, or -1 on a write error
+static int
+WriteAll (int fd, struct iovec *iov, int n, char *name)
+{
+    ssize_t      put;
+
+    while (n > 0) {
+        put = writev (fd, iov, n);
+        if (put < 0) {
+            if (errno == EINTR)
+                continue;
+            perror (name);
+            return -1;
+        }
+        // step over whatever went out
+        while (n > 0 && (size_t) put >= iov->iov_len) {
+            put -= iov->iov_len;
+            iov ++;
+            n --;
+        }
+        if (n > 0) {
+            iov->iov_base = (char *) iov->iov_base + put;
+            iov->iov_len -= put;
+        }
+    }
+    return 0;
+}
+
+// Level 4: header, name and data in one writev()
+static int
+MatlabWriteV4 (void *a, int nr, int nc, int kind, char *name, FILE *fp)
+{
+    MATheader    h;
+    struct iovec iov[3];
+
+    h.type = architecture ( )*1000 + 0*100 + kinds[kind].precision*10 + 0*1;
+                                     /* reserved */
+                                             /* precision */
+                                                            /* numeric full matrix */
+    h.mrows = nr;
+    h.ncols = nc;
+    h.imagf = 0;
+    h.namlen = strlen(name) + 1;
+
+    iov[0].iov_base = &h;
+    iov[0].iov_len = sizeof(MATheader);
+    iov[1].iov_base = name;
+    iov[1].iov_len = h.namlen;
+    iov[2].iov_base = a;
+    iov[2].iov_len = kinds[kind].size * nr * nc;
+
+    return WriteAll (fileno(fp), iov, 3, name);
+}
+
+// Level 5: a miMATRIX element - flags, dimensions, name and real part -
+// deflated into a miCOMPRESSED element.  The subelement headers are
+// built in hdr and the data is fed to deflate straight from a.  Level 1
+// gets most of the size back in a fraction of the time, which matters
+// with the converters run under a timeout.  Should there not be memory
+// for the compressed copy the matrix goes out as it is.
+static int
+MatlabWriteV5 (void *a, int nr, int nc, int kind, char *name, FILE *fp)
+{
+    static char    zero[8];
+    unsigned char  hdr[56 + 64];
+    unsigned int   w[12];
+    size_t         namlen = strlen(name);
+    size_t         nbytes = kinds[kind].size * nr * nc;
+    size_t         nhdr;
+    unsigned char *z = NULL;
+    z_stream       zs;
+    struct iovec   iov[3];
+    unsigned int   tag[2];
+    int            r;
+
+    if (namlen > 63)
+        namlen = 63;
+
+    w[0] = miMATRIX;
+    w[1] = 48 + PAD8(namlen) + PAD8(nbytes);
+    w[2] = miUINT32;
+    w[3] = 8;
+    w[4] = kinds[kind].mx;
+    w[5] = 0;
+    w[6] = miINT32;
+    w[7] = 8;
+    w[8] = nr;
+    w[9] = nc;
+    w[10] = miINT8;
+    w[11] = namlen;
+    memcpy (hdr, w, sizeof(w));
+    memset (hdr + sizeof(w), 0, PAD8(namlen));
+    memcpy (hdr + sizeof(w), name, namlen);
+    nhdr = sizeof(w) + PAD8(namlen);
+    w[0] = kinds[kind].mi;
+    w[1] = nbytes;
+    memcpy (hdr + nhdr, w, 8);
+    nhdr += 8;
+
+    memset (&zs, 0, sizeof(zs));
+    if (deflateInit (&zs, Z_BEST_SPEED) == Z_OK) {
+        zs.avail_out = deflateBound (&zs, nhdr + PAD8(nbytes));
+        z = malloc (zs.avail_out);
+    }
+    if (z) {
+        zs.next_out = z;
+        zs.next_in = hdr;
+        zs.avail_in = nhdr;
+        deflate (&zs, Z_NO_FLUSH);
+        zs.next_in = a;
+        zs.avail_in = nbytes;
+        deflate (&zs, Z_NO_FLUSH);
+        zs.next_in = (unsigned char *) zero;
+        zs.avail_in = PAD8(nbytes) - nbytes;
+        if (deflate (&zs, Z_FINISH) != Z_STREAM_END) {
+            free (z);
+            z = NULL;
+        }
+    }
+
+    if (z) {
+        tag[0] = miCOMPRESSED;
+        tag[1] = zs.total_out;
+        iov[0].iov_base = tag;
+        iov[0].iov_len = sizeof(tag);
+        iov[1].iov_base = z;
+        iov[1].iov_len = zs.total_out;
+        r = WriteAll (fileno(fp), iov, 2, name);
+        free (z);
+    }
+    else {
+        iov[0].iov_base = hdr;
+        iov[0].iov_len = nhdr;
+        iov[1].iov_base = a;
+        iov[1].iov_len = nbytes;
+        iov[2].iov_base = zero;
+        iov[2].iov_len = PAD8(nbytes) - nbytes;
+        r = WriteAll (fileno(fp), iov, 3, name);
+    }
+    deflateEnd (&zs);
+    return r;
+}
+
+// Anything already buffered in fp goes first so the file stays in order.
+// Returns 0, or -1 if the variable (or what was buffered) did not all
+// get written.
+static int
+MatlabWrite (void *a, int nr, int nc, int kind, char *name, MATfile *mf)
+{
+    if (fflush (mf->fp) != 0) {
+        perror (name);
+        return -1;
+    }
+    if (mf->v5)
+        return MatlabWriteV5 (a, nr, nc, kind, name, mf->fp);
+    else
+        return MatlabWriteV4 (a, nr, nc, kind, name, mf->fp);
+}
+
+/// Sets mf up to write to fp, starting it with the level 5 header if v5
+/// is set (level 4 files have no header of their own)
+void
+MatlabOpen (MATfile *mf, FILE *fp, int v5)
+{
+    char            text[116 + 8];
+    unsigned short  version = 0x0100;
+    unsigned short  endian = ('M' << 8) | 'I';
+    time_t          now = time(NULL);
+    struct tm       tm;
+    int             n;
+
+    mf->fp = fp;
+    mf->v5 = v5;
+    if (!v5)
+        return;
+
+    memset (text, ' ', 116);
+    memset (text + 116, 0, 8);
+    n = strftime (text, 116, "MATLAB 5.0 MAT-file, Created on: %a %b %d %H:%M:%S %Y", gmtime_r(&now, &tm));
+    text[n] = ' ';
+
+    fwrite (text, 1, sizeof(text), fp);
+    fwrite (&version, sizeof(version), 1, fp);
+    fwrite (&endian, sizeof(endian), 1, fp);
+}
+
+int 
+MatlabDoubleVector (double *a, int n, char *name, MATfile *mf)
+{
+    return MatlabWrite (a, n, 1, KIND_DOUBLE, name, mf);
+}
+
+int 
+MatlabVector (short *a, int n, char *name, MATfile *mf, int unsign)
+{
+    return MatlabWrite (a, n, 1, unsign ? KIND_UINT16 : KIND_INT16, name, mf);
+}
+
+/// a holds nc columns of nr values, one column after another
+int 
+MatlabDoubleMatrix (double *a, int nr, int nc, char *name, MATfile *mf)
+{
+    return MatlabWrite (a, nr, nc, KIND_DOUBLE, name, mf);
+}
+
+/// a holds nc columns of nr values, one column after another
+int 
+MatlabMatrix (short *a, int nr, int nc, char *name, MATfile *mf)
+{
+    return MatlabWrite (a, nr, nc, KIND_INT16, name, mf);
+}
+
+/// a holds nc columns of nr values, one column after another
+int 
+MatlabByteMatrix (unsigned char *a, int nr, int nc, char *name, MATfile *mf)
+{
+    return MatlabWrite (a, nr, nc, KIND_UINT8, name, mf);
+}
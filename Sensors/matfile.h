@@ -0,0 +1,47 @@
+//
+// Copyright (c) 2018, 2023 University of Washington.  All rights reserved.
+//
+// This file contains proprietary information and remains the 
+// unpublished property of the University of Washington. Use, disclosure,
+// or reproduction is prohibited.
+//
+
+// MAT-file writer shared by sc2mat and ad2cpMAT.  Every variable is
+// passed in already laid out the way the file wants it - a matrix as nc
+// columns of nr values, one column after another - and goes out in a
+// single writev().  Files are level 4 unless opened with v5 set, in
+// which case each variable is a deflated level 5 element of its own
+// integer (or double) class.  The format is kept with each file, so
+// outputs open at the same time (libad2cp is loaded in-process) do not
+// share it.
+
+# ifndef MATFILE_H
+# define MATFILE_H
+
+# include <stdio.h>
+
+typedef struct {
+    int  type;
+    int  mrows;
+    int ncols;
+    int imagf;
+    int namlen;
+} MATheader;
+
+/// An output file and the format its variables go out in
+typedef struct {
+    FILE *fp;
+    int   v5;
+} MATfile;
+
+// The variable writers return 0, or -1 (after perror) if it did not all
+// get written
+int  MatlabDoubleVector (double *a, int n, char *name, MATfile *mf);
+int  MatlabVector (short *a, int n, char *name, MATfile *mf, int unsign);
+int  MatlabDoubleMatrix (double *a, int nr, int nc, char *name, MATfile *mf);
+int  MatlabMatrix (short *a, int nr, int nc, char *name, MATfile *mf);
+int  MatlabByteMatrix (unsigned char *a, int nr, int nc, char *name, MATfile *mf);
+
+void MatlabOpen (MATfile *mf, FILE *fp, int v5);
+
+# endif
@@ -6,35 +6,51 @@
 // or reproduction is prohibited.
 //
 
-// gcc -o sc2mat sc2mat.c
+// gcc -o sc2mat sc2mat.c ad2cp.c matfile.c -lm -lz
+//
+// Each input is mapped (or read whole) by libad2cp and decoded from an
+// in-memory cursor.  Per-record columns are contiguous and grow
+// geometrically, with matrices held one ensemble (column) after another
+// - the MAT-file order - so memory follows the records actually present
+// and each variable goes out in one write (see matfile.c).
 
 # include <stdio.h>
 # include <math.h>
 # include <string.h>
 # include <time.h>
 # include <stdlib.h>
+# include <unistd.h>
+# include "matfile.h"
+# include "ad2cp.h"
 
 typedef struct {
-   int  type;
-   int  mrows;
-   int ncols;
-   int imagf;
-   int namlen;
-} MATheader;
+   unsigned char *p;
+   unsigned char *end;
+} Cursor;
 
-static FILE	*fp, *out;
+static FILE	*out;
+static MATfile   mat;
 
 static int      num_beams;
 static int      num_cells;
 static int      count;
 static int      countAtt;
 static int      countBurst;
+static int      verbose;      // -v: trace every record on stderr
+static int      reshaped;     // ensembles cut or zero-filled to ensCells
+static long     skipped;      // stray bytes between records
 
 unsigned short burstBeams;    
 unsigned short burstCells;
 unsigned short burst_cellSize;
 
-static double **beamv[4];
+static int      ensCells;     // cells per ensemble as stored
+static int      capEns;
+static int      capAtt;
+static int      capBurst;
+static int      burstWidth;   // cells per burst ping as stored
+
+static double  *beamv[3];
 static double	*temperature;
 static double	*pressure;
 static double   *battery;
@@ -62,276 +78,174 @@ static double *pressureBurst;
 static double *pitchBurst;
 static double *rollBurst;
 static double *headingBurst;
-static double  **corr = NULL;
-static double  **vBurst = NULL;
+static unsigned char *corr = NULL;
+static short   *vBurst = NULL;
 
 
-static int 
-architecture ( )
+/// Makes room for cap records of width elements of size bytes in *x
+static void
+Reserve(void *x, int cap, int width, size_t size)
 {
-   int  x = 1;
-
-   if (*((char *) &x) == 1)
-      return 0;
-   else
-      return 1;
-}
+   void      *p;
 
-static void 
-MatlabDoubleVector (double *a, int n, char *name, FILE *fp)
-{
-   int         arch;
-   int         mopt;
-   double       x;
-   unsigned    i;
-   MATheader   h;
-
-   arch = architecture ( );
-
-
-   mopt = arch*1000 + 0*100 + 0*10 + 0*1;
-                      /* reserved */
-                              /* double precision */
-                                     /* numeric full matrix */
-   h.type = mopt;
-   h.mrows = n;
-   h.ncols = 1;
-   h.imagf = 0;
-   h.namlen = strlen(name) + 1;
-
-   fwrite (&h, sizeof(MATheader), 1, fp);
-   fwrite (name, sizeof(char), h.namlen, fp);
-
-   for (i = 0 ; i < n ; i++) {
-      x = a [i];
-      fwrite (&x, sizeof(double), 1, fp);
+   p = realloc(*(void **) x, size * cap * (width ? width : 1));
+   if (p == NULL) {
+      fprintf(stderr, "sc2mat: out of memory at %d records\n", cap);
+      exit(1);
    }
-
-   return;
+   *(void **) x = p;
 }
 
-static void 
-MatlabVector (short *a, int n, char *name, FILE *fp, int unsign)
+/// Writes the int16 (size 2) or uint8 (size 1) burst matrix a as itself,
+/// or as the doubles level 4 files have always carried
+/// \return 0, or -1 on a write error
+static int
+BurstMatrix(void *a, size_t size, int nr, int nc, char *name)
 {
-   int         arch;
-   int         mopt;
-   short       x;
-   unsigned    i;
-   MATheader   h;
-
-   arch = architecture ( );
-
-
-   mopt = arch*1000 + 0*100 + (3 + unsign)*10 + 0*1;
-                      /* reserved */
-                              /* short precision */
-                                     /* numeric full matrix */
-   h.type = mopt;
-   h.mrows = n;
-   h.ncols = 1;
-   h.imagf = 0;
-   h.namlen = strlen(name) + 1;
-
-   fwrite (&h, sizeof(MATheader), 1, fp);
-   fwrite (name, sizeof(char), h.namlen, fp);
-
-   for (i = 0 ; i < n ; i++) {
-      x = (short) a [i];
-      fwrite (&x, sizeof(short), 1, fp);
+   double    *w;
+   size_t     i, n = (size_t) nr * nc;
+   int        r;
+
+   if (mat.v5) {
+      if (size == 1)
+         return MatlabByteMatrix(a, nr, nc, name, &mat);
+      else
+         return MatlabMatrix(a, nr, nc, name, &mat);
    }
-
-   return;
-}
-
-static void 
-MatlabMatrix (short **a, int nr, int nc, char *name, FILE *fp)
-{
-   int         arch;
-   int         mopt;
-   short       x;
-   unsigned    i, j;
-   MATheader   h;
-
-   arch = architecture ( );
-
-   mopt = arch*1000 + 0*100 + 3*10 + 0*1;
-                      /* reserved */
-                              /* short precision */
-                                     /* numeric full matrix */
-   h.type = mopt;
-   h.mrows = nr;
-   h.ncols = nc;
-   h.imagf = 0;
-
-   h.namlen = strlen(name) + 1;
-
-   fwrite (&h, sizeof(MATheader), 1, fp);
-   fwrite (name, sizeof(char), h.namlen, fp);
-
-   for (i = 0 ; i < nc ; i++) {
-      for (j = 0 ; j < nr ; j++) {
-         x = a [j][i];
-         fwrite (&x, sizeof(short), 1, fp);
-      }
+   if ((w = (double *) malloc(sizeof(double) * (n ? n : 1))) == NULL) {
+      fprintf(stderr, "sc2mat: out of memory writing %s\n", name);
+      exit(1);
    }
-
-   return;
-}
-
-static void 
-MatlabDoubleMatrix (double **a, int nr, int nc, char *name, FILE *fp)
-{
-   int         arch;
-   int         mopt;
-   double       x;
-   unsigned    i, j;
-   MATheader   h;
-
-   arch = architecture ( );
-
-   mopt = arch*1000 + 0*100 + 0*10 + 0*1;
-                      /* reserved */
-                              /* double float precision */
-                                     /* numeric full matrix */
-   h.type = mopt;
-   h.mrows = nr;
-   h.ncols = nc;
-   h.imagf = 0;
-
-   h.namlen = strlen(name) + 1;
-
-   fwrite (&h, sizeof(MATheader), 1, fp);
-   fwrite (name, sizeof(char), h.namlen, fp);
-
-   for (i = 0 ; i < nc ; i++) {
-      for (j = 0 ; j < nr ; j++) {
-         x = a [j][i];
-         fwrite (&x, sizeof(double), 1, fp);
-      }
-   }
-
-   return;
-}
-
-static double *
-Dvector(int nr)
-{
-   double     *x;
-
-   x = (double *) malloc(sizeof(double) * nr);
-
-   return x;
-}
-
-static double **
-Darray(int nr, int nc)
-{
-   short      i;
-   double    **x;
-
-   x = (double **) malloc(sizeof(double *) * nr);
-   for (i = 0 ; i < nr ; i++)
-      x [i] = (double *) malloc(sizeof(double) * nc);
-
-   return x;
+   for (i = 0 ; i < n ; i++)
+      w[i] = size == 1 ? ((unsigned char *) a)[i] : ((short *) a)[i];
+   r = MatlabDoubleMatrix(w, nr, nc, name, &mat);
+   free(w);
+   return r;
 }
 
-static short *
-vector(int nr)
+/// Grows a record group's capacity geometrically once n reaches it
+static int
+NextCap(int n, int cap)
 {
-   int      i;
-   short     *x;
-
-   x = (short *) malloc(sizeof(short) * nr);
-
-   return x;
+   return n < cap ? cap : (cap ? cap * 2 : 256);
 }
 
-static short **
-array(int nr, int nc)
-{
-   short      i;
-   short    **x;
-
-   x = (short **) malloc(sizeof(short *) * nr);
-   for (i = 0 ; i < nr ; i++)
-      x [i] = (short *) malloc(sizeof(short) * nc);
-
-   return x;
-}
-
-
 static void 
 WriteMatlab(char *fname)
 {
+   int bad = 0;
+
 //   fprintf (stderr,"%02d:%02d:%02d.%02d on %02d/%02d/%04d\n",
 //            tm.tm_hour, tm.tm_min, tm.tm_sec, hsec, 
 //            tm.tm_mon + 1, tm.tm_mday, tm.tm_year + 1900);
    fprintf(stderr, "%s: %d ensembles\n", fname, count);
    fprintf(stderr, "%s: %d burst pings\n", fname, countBurst);
    fprintf(stderr, "%s: %d attitude records\n", fname, countAtt);
+   if (reshaped || skipped)
+      fprintf(stderr, "WARNING - %d ensembles reshaped, %ld stray bytes skipped\n",
+              reshaped, skipped);
 
-   MatlabDoubleVector(g_blanking, 1, "blanking", out);
-   MatlabDoubleVector(g_cellSize, 1, "cellSize", out);
-   MatlabDoubleVector(g_soundspeed, 1, "soundspeed", out);
+   bad |= MatlabDoubleVector(g_blanking, 1, "blanking", &mat);
+   bad |= MatlabDoubleVector(g_cellSize, 1, "cellSize", &mat);
+   bad |= MatlabDoubleVector(g_soundspeed, 1, "soundspeed", &mat);
 
-   MatlabDoubleMatrix(beamv[0], num_cells, count, "velX", out);   
-   MatlabDoubleMatrix(beamv[1], num_cells, count, "velY", out);   
-   MatlabDoubleMatrix(beamv[2], num_cells, count, "velZ", out);   
+   bad |= MatlabDoubleMatrix(beamv[0], count ? ensCells : num_cells, count, "velX", &mat);
+   bad |= MatlabDoubleMatrix(beamv[1], count ? ensCells : num_cells, count, "velY", &mat);
+   bad |= MatlabDoubleMatrix(beamv[2], count ? ensCells : num_cells, count, "velZ", &mat);
 
-   MatlabDoubleVector(pressure, count, "pressure", out);
-   MatlabDoubleVector(battery, count, "battery", out);
-   MatlabDoubleVector(temperature, count, "temperature", out);
-   MatlabDoubleVector(heading, count, "heading", out);
-   MatlabDoubleVector(pitch, count, "pitch", out);
-   MatlabDoubleVector(roll, count, "roll", out);
+   bad |= MatlabDoubleVector(pressure, count, "pressure", &mat);
+   bad |= MatlabDoubleVector(battery, count, "battery", &mat);
+   bad |= MatlabDoubleVector(temperature, count, "temperature", &mat);
+   bad |= MatlabDoubleVector(heading, count, "heading", &mat);
+   bad |= MatlabDoubleVector(pitch, count, "pitch", &mat);
+   bad |= MatlabDoubleVector(roll, count, "roll", &mat);
 
-   MatlabDoubleVector(t, count, "time", out);
+   bad |= MatlabDoubleVector(t, count, "time", &mat);
 
    if (countAtt > 0) {
-      MatlabDoubleVector(pressureAtt, countAtt, "pressureAtt", out);
-      MatlabDoubleVector(headingAtt, countAtt, "headingAtt", out);
-      MatlabDoubleVector(pitchAtt, countAtt, "pitchAtt", out);
-      MatlabDoubleVector(rollAtt, countAtt, "rollAtt", out);
-      MatlabDoubleVector(tAtt, countAtt, "timeAtt", out);
-      MatlabDoubleVector(magXAtt, countAtt, "magXAtt", out);
-      MatlabDoubleVector(magYAtt, countAtt, "magYAtt", out);
-      MatlabDoubleVector(magZAtt, countAtt, "magZAtt", out);
+      bad |= MatlabDoubleVector(pressureAtt, countAtt, "pressureAtt", &mat);
+      bad |= MatlabDoubleVector(headingAtt, countAtt, "headingAtt", &mat);
+      bad |= MatlabDoubleVector(pitchAtt, countAtt, "pitchAtt", &mat);
+      bad |= MatlabDoubleVector(rollAtt, countAtt, "rollAtt", &mat);
+      bad |= MatlabDoubleVector(tAtt, countAtt, "timeAtt", &mat);
+      bad |= MatlabDoubleVector(magXAtt, countAtt, "magXAtt", &mat);
+      bad |= MatlabDoubleVector(magYAtt, countAtt, "magYAtt", &mat);
+      bad |= MatlabDoubleVector(magZAtt, countAtt, "magZAtt", &mat);
    }
 
    if (countBurst > 0) {
-      MatlabDoubleVector(pressureBurst, countBurst, "pressureBurst", out);
-      MatlabDoubleVector(headingBurst, countBurst, "headingBurst", out);
-      MatlabDoubleVector(pitchBurst, countBurst, "pitchBurst", out);
-      MatlabDoubleVector(rollBurst, countBurst, "rollBurst", out);
-      MatlabDoubleVector(tBurst, countBurst, "timeBurst", out);
-      MatlabDoubleMatrix(corr, burstCells, countBurst, "corrBurst", out);
-      MatlabDoubleMatrix(vBurst, burstCells, countBurst, "velBurst", out);
+      bad |= MatlabDoubleVector(pressureBurst, countBurst, "pressureBurst", &mat);
+      bad |= MatlabDoubleVector(headingBurst, countBurst, "headingBurst", &mat);
+      bad |= MatlabDoubleVector(pitchBurst, countBurst, "pitchBurst", &mat);
+      bad |= MatlabDoubleVector(rollBurst, countBurst, "rollBurst", &mat);
+      bad |= MatlabDoubleVector(tBurst, countBurst, "timeBurst", &mat);
+      bad |= BurstMatrix(corr, 1, burstWidth, countBurst, "corrBurst");
+      bad |= BurstMatrix(vBurst, sizeof(short), burstWidth, countBurst, "velBurst");
+   }
+   if (fclose(out) != 0 || bad) {
+      fprintf(stderr, "sc2mat: %s not completely written\n", fname);
+      exit(1);
    }
-   fclose(out);
 
    exit (0);
 }
 
+/// Copies n bytes out from the cursor
+/// \return 0, or -1 (cursor run to the end) if there are not n left
+static int
+take(Cursor *c, void *dst, size_t n)
+{
+    if ((size_t) (c->end - c->p) < n) {
+        c->p = c->end;
+        return -1;
+    }
+    memcpy(dst, c->p, n);
+    c->p += n;
+    return 0;
+}
+
+/// Echoes a "% ..." comment line, consuming it and its newline
+static void
+comment(Cursor *c)
+{
+    unsigned char *nl;
+
+    nl = memchr(c->p, 10, c->end - c->p);
+    printf("%% ");
+    fwrite(c->p, 1, (nl ? nl : c->end) - c->p, stdout);
+    printf("\n");
+    c->p = nl ? nl + 1 : c->end;
+}
+
+/// Little-endian short at p (any alignment)
+static short
+s16(unsigned char *p)
+{
+    short x;
+
+    memcpy(&x, p, sizeof(short));
+    return x;
+}
+
 int 
 main(int argc, char *argv[])
 {
-    char c;
     double scale;
-    unsigned char b, n, ii, j, k, id, fam;
+    unsigned char j, id;
+    int ii;
+    int opt;
+    int v5 = 0;
     unsigned short i;
-    unsigned short sz, ckd, ckh;
-    struct tm tm;
-    time_t tt, ttAtt;
-    int    max_count, max_countAtt;
+    unsigned short sz;
     unsigned short sync;
     unsigned char  sync1;
     long tell;
-    unsigned char  buff[65536];
+    unsigned char  buff[8];
+    unsigned short beams, cells;
     unsigned short cellSize;
     unsigned short blanking;
     unsigned short soundSpeed;
-    char           velocityScaling;
+    char           velocityScaling = 0;
     int            epoch;
     unsigned int   pressureInstant;
     unsigned int   pressureAvg;
@@ -343,135 +257,148 @@ main(int argc, char *argv[])
     short          rollAvg;
     short          rollInstant;
     unsigned short batteryAvg;
-    short          hVel[65536];
-    unsigned char  hCorr[65536];
     short          magnHxHyHz[3];
+    unsigned char *base, *src, *a1;
+    size_t         len, need;
+    int            mapped;
+    int            ncopy;
+    Cursor         c;
+    double        *v;
 
     count = 0;
     countAtt = 0;
     countBurst = 0;
-    max_count = max_countAtt = 200000;
 
     setenv("TZ", "", 1); // null string is UTC
     tzset();
 
-    if (argc < 3 
+    while ((opt = getopt(argc, argv, "vz")) != -1) {
+        switch (opt) {
+        case 'v':
+            verbose = 1;
+            break;
+        case 'z':
+            v5 = 1;
+            break;
+        }
+    }
+
+    if ((argc - optind) < 2
         || (out = fopen(argv[argc-1], "wb")) == NULL) {
        
-        printf("sc2mat in1 in2 in3 ... out\n");
+        printf("sc2mat [-v] [-z] in1 in2 in3 ... out\n");
         return 1;
     } 
+    MatlabOpen(&mat, out, v5);
 
-    for (ii = 1 ; ii <= argc - 2 ; ii++) {
-        if ((fp = fopen(argv[ii], "rb")) == NULL)
-            break;
+    for (ii = optind ; ii <= argc - 2 ; ii++) {
+        if ((base = MapFile(argv[ii], &len, &mapped)) == NULL) {
+            fprintf(stderr, "WARNING - cannot open %s - skipping\n", argv[ii]);
+            continue;
+        }
 
-        while(!feof(fp)) {
-            if (fread(&sync1, sizeof(unsigned char), 1, fp) != 1)
-                break;
+        c.p = base;
+        c.end = base + len;
+
+        while(c.p < c.end) {
+            sync1 = *c.p++;
 
             if (sync1 == '%') {
-                if (fread(&sync1, sizeof(unsigned char), 1, fp) != 1)
+                if (c.p == c.end)
                     break;
-               
-                if (sync1 == ' ') {
-                    printf("%% ");    
-                    while(fread(&c, sizeof(char), 1, fp) == 1 && c != 10) {
-                        printf("%c", c);
-                    }
-                    printf("\n");
-                }
+
+                sync1 = *c.p++;
+                if (sync1 == ' ')
+                    comment(&c);
                 continue;
             }
             else  if (sync1 != 0xa5) {
-                printf("sync 1 after header block = %x\n", sync1);
+                skipped ++;
+                if (verbose)
+                    fprintf(stderr, "sync 1 after header block = %x\n", sync1);
                 continue;
             }
-            if (fread(&sync1, sizeof(unsigned char), 1, fp) != 1)
+            if (c.p == c.end)
                 break;
 
+            sync1 = *c.p++;
             if (sync1 != 0x0a) {
-                printf("sync1 after ad2cp header start = %x\n", sync1);
+                skipped ++;
+                if (verbose)
+                    fprintf(stderr, "sync1 after ad2cp header start = %x\n", sync1);
                 continue;
             }
  
-            if (fread(buff, sizeof(unsigned char), 8, fp) != 8)
+            if (take(&c, buff, 8))
                 break;
 
             id  = buff[0];
-            fam = buff[1];
-            sz = *((unsigned short *) &(buff[2]));
-            ckd = buff[4] + buff[5]*256;
-            ckh = buff[6] + buff[7]*256;
-
-            printf("header size = %d\n", sz);
-            for (i = 0 ; i < sz ; i++) {
-                if (fread(&buff[i], sizeof(unsigned char), 1, fp) != 1)
-                    break;
-
-                if (buff[i] == 0xa1) {
-                    fseek(fp, -1, SEEK_CUR);
-                    break;
-                }
-            }
-
-	        tell = ftell(fp);
-            printf("after header tell = %ld, count = %d\n", tell, count);
-
-            if (id == 0xa0) {
-                buff[sz] = 0;
+            sz = buff[2] + buff[3]*256;
+
+            // the header body runs sz bytes or up to the first 0xa1 -
+            // the scicon cuts the string record short, so there is no
+            // data checksum to hold it to
+            if (verbose) fprintf(stderr, "header size = %d\n", sz);
+            need = (size_t) (c.end - c.p) < sz ? (size_t) (c.end - c.p) : sz;
+            if ((a1 = memchr(c.p, 0xa1, need)) != NULL)
+                c.p = a1;
+            else
+                c.p += need;
+
+            tell = c.p - base;
+            if (verbose) fprintf(stderr, "after header tell = %ld, count = %d\n", tell, count);
+
+            if (id == 0xa0)
                 break;
-            }
         }
-        while(!feof(fp)) {
-            if (fread(&sync, sizeof(unsigned short), 1, fp) != 1)
-                break;
+
+        // records - a truncated one ends the file
+        while(take(&c, &sync, sizeof(sync)) == 0) {
 
             if (sync == 0xa5a1) {
+                if (take(&c, &beams, 2) || take(&c, &cells, 2)
+                    || take(&c, &cellSize, 2) || take(&c, &blanking, 2)
+                    || take(&c, &soundSpeed, 2) || take(&c, &velocityScaling, 1))
+                    break;
 
-                fread(&num_beams, sizeof(unsigned short), 1, fp);
-                fread(&num_cells, sizeof(unsigned short), 1, fp);
-                fread(&cellSize, sizeof(unsigned short), 1, fp);
-                fread(&blanking, sizeof(unsigned short), 1, fp); // 8
-                fread(&soundSpeed, sizeof(unsigned short), 1, fp);
-                fread(&velocityScaling, sizeof(char), 1, fp);
-	            tell = ftell(fp);
-                printf("after meta tell = %ld, count = %d\n", tell, count);
+                num_beams = beams;
+                num_cells = cells;
+                tell = c.p - base;
+                if (verbose) fprintf(stderr, "after meta tell = %ld, count = %d\n", tell, count);
                 g_cellSize[0] = cellSize;
                 g_blanking[0] = blanking;
                 g_soundspeed[0] = soundSpeed;
                 continue;
             }
             if (sync == 0xa5a2) {
+                if (take(&c, &burstBeams, 2) || take(&c, &burstCells, 2)
+                    || take(&c, &burst_cellSize, 2))
+                    break;
 
-                fread(&burstBeams, sizeof(unsigned short), 1, fp);
-                fread(&burstCells, sizeof(unsigned short), 1, fp);
-                fread(&burst_cellSize, sizeof(unsigned short), 1, fp);
-	            tell = ftell(fp);
-                printf("after burst meta tell = %ld, count = %d\n", tell, count);
+                tell = c.p - base;
+                if (verbose) fprintf(stderr, "after burst meta tell = %ld, count = %d\n", tell, count);
                 g_burstSize[0] = burst_cellSize;
-                printf("0xa5a2 record: %d %d\n", burstBeams, burstCells);
+                if (verbose) fprintf(stderr, "0xa5a2 record: %d %d\n", burstBeams, burstCells);
                 continue;
             }
 
 
             if (sync == 0xa5a3) {
-                fread(&epoch, sizeof(int), 1, fp);
-                fread(&pressureAvg, sizeof(unsigned int), 1, fp);
-                fread(&headingAvg, sizeof(unsigned short), 1, fp);
-                fread(&pitchAvg, sizeof(short), 1, fp);
-                fread(&rollAvg, sizeof(short), 1, fp);
-                fread(&magnHxHyHz, sizeof(unsigned short), 3, fp);
-
-                if (countAtt == 0) {
-                    tAtt           = Dvector(max_countAtt);
-                    pressureAtt    = Dvector(max_countAtt); 
-                    pitchAtt       = Dvector(max_countAtt); 
-                    rollAtt        = Dvector(max_countAtt); 
-                    headingAtt     = Dvector(max_countAtt); 
-                    magXAtt     = Dvector(max_countAtt); 
-                    magYAtt     = Dvector(max_countAtt); 
-                    magZAtt     = Dvector(max_countAtt); 
+                if (take(&c, &epoch, 4) || take(&c, &pressureAvg, 4)
+                    || take(&c, &headingAvg, 2) || take(&c, &pitchAvg, 2)
+                    || take(&c, &rollAvg, 2) || take(&c, magnHxHyHz, 6))
+                    break;
+
+                if (countAtt == capAtt) {
+                    capAtt = NextCap(countAtt, capAtt);
+                    Reserve(&tAtt, capAtt, 1, sizeof(double));
+                    Reserve(&pressureAtt, capAtt, 1, sizeof(double));
+                    Reserve(&pitchAtt, capAtt, 1, sizeof(double));
+                    Reserve(&rollAtt, capAtt, 1, sizeof(double));
+                    Reserve(&headingAtt, capAtt, 1, sizeof(double));
+                    Reserve(&magXAtt, capAtt, 1, sizeof(double));
+                    Reserve(&magYAtt, capAtt, 1, sizeof(double));
+                    Reserve(&magZAtt, capAtt, 1, sizeof(double));
                 }
 
                 tAtt[countAtt]        = epoch;
@@ -483,38 +410,45 @@ main(int argc, char *argv[])
                 magYAtt[countAtt]    = magnHxHyHz[1];
                 magZAtt[countAtt]    = magnHxHyHz[2];
                 countAtt ++;
-	            tell = ftell(fp);
-                // printf("after att tell = %ld, count = %d\n", tell, countAtt);
 
                 continue;
             }
 
             if (sync == 0x2025) {
-                printf("%% ");    
-                while(fread(&c, sizeof(char), 1, fp) == 1 && c != 10) {
-                    printf("%c", c);
-                }
-                printf("\n");
+                comment(&c);
                 continue;
             }
 
             if (sync == 0xa5a6) {
-                fread(&epoch, sizeof(int), 1, fp);
-                fread(&pressureInstant, sizeof(unsigned int), 1, fp);
-                fread(&headingInstant, sizeof(unsigned short), 1, fp);
-                fread(&pitchInstant, sizeof(short), 1, fp);
-                fread(&rollInstant, sizeof(short), 1, fp);
-
-                printf("0xa5a6 record: %d %u\n", epoch, pressureInstant);
-
-                if (countBurst == 0) {
-                    corr = Darray(burstCells, max_count);
-                    tBurst = Dvector(max_count);
-                    pressureBurst = Dvector(max_count);
-                    headingBurst  = Dvector(max_count);
-                    pitchBurst    = Dvector(max_count);
-                    rollBurst     = Dvector(max_count);
-                    vBurst        = Darray(burstCells, max_count);
+                if (take(&c, &epoch, 4) || take(&c, &pressureInstant, 4)
+                    || take(&c, &headingInstant, 2) || take(&c, &pitchInstant, 2)
+                    || take(&c, &rollInstant, 2))
+                    break;
+
+                if (verbose) fprintf(stderr, "0xa5a6 record: %d %u\n", epoch, pressureInstant);
+
+                // velocity then correlation, burstCells per beam; the
+                // first beam is kept
+                need = (size_t) burstCells * burstBeams * 3;
+                if ((size_t) (c.end - c.p) < need) {
+                    c.p = c.end;
+                    break;
+                }
+                src = c.p;
+                c.p += need;
+
+                if (countBurst == 0)
+                    burstWidth = burstCells;
+
+                if (countBurst == capBurst) {
+                    capBurst = NextCap(countBurst, capBurst);
+                    Reserve(&corr, capBurst, burstWidth, 1);
+                    Reserve(&tBurst, capBurst, 1, sizeof(double));
+                    Reserve(&pressureBurst, capBurst, 1, sizeof(double));
+                    Reserve(&headingBurst, capBurst, 1, sizeof(double));
+                    Reserve(&pitchBurst, capBurst, 1, sizeof(double));
+                    Reserve(&rollBurst, capBurst, 1, sizeof(double));
+                    Reserve(&vBurst, capBurst, burstWidth, sizeof(short));
                 }
 
                 tBurst[countBurst]        = epoch;
@@ -522,44 +456,60 @@ main(int argc, char *argv[])
                 headingBurst[countBurst]  = headingInstant*0.01;
                 pitchBurst[countBurst]    = pitchInstant*0.01;
                 rollBurst[countBurst]     = rollInstant*0.01;
-                fread(hVel, sizeof(short), burstCells * burstBeams, fp);
-                for (i = 0 ; i < burstCells ; i++)
-                    vBurst[i][countBurst] = hVel[i];
 
-                fread(hCorr, sizeof(unsigned char), burstCells * burstBeams, fp);
-                for (i = 0 ; i < burstCells ; i++)
-                    corr[i][countBurst] = hCorr[i];
+                ncopy = burstBeams ? (burstCells < burstWidth ? burstCells : burstWidth) : 0;
+                // both kept as they arrive - int16 and uint8
+                memset(vBurst + (size_t) countBurst * burstWidth, 0, sizeof(short) * burstWidth);
+                memcpy(vBurst + (size_t) countBurst * burstWidth, src, sizeof(short) * ncopy);
 
+                src += (size_t) burstCells * burstBeams * 2;
+                memset(corr + (size_t) countBurst * burstWidth, 0, burstWidth);
+                memcpy(corr + (size_t) countBurst * burstWidth, src, ncopy);
 
                 countBurst ++;
                 continue;
             }
 
             if (sync == 0xa5a5) {
-                fread(&epoch, sizeof(int), 1, fp);
-                fread(&pressureInstant, sizeof(unsigned int), 1, fp);
+                if (take(&c, &epoch, 4) || take(&c, &pressureInstant, 4))
+                    break;
 
                 scale = pow(10.0, velocityScaling);
-                printf("0xa5a5 record: %d %d %d %u %f\n", num_beams, num_cells, epoch, pressureInstant, scale); 
-
-                fread(&pressureAvg, sizeof(unsigned int), 1, fp);
-                fread(&temperatureAvg, sizeof(short), 1, fp);
-                fread(&headingAvg, sizeof(unsigned short), 1, fp);
-                fread(&pitchAvg, sizeof(short), 1, fp);
-                fread(&rollAvg, sizeof(short), 1, fp);
-                fread(&batteryAvg, sizeof(unsigned short), 1, fp);
-
-                 if (count == 0) {
-                    for (j = 0 ; j < 4 ; j++) {
-                        beamv[j] = Darray(num_cells, max_count);
-                    }
-                    t           = Dvector(max_count);
-                    pressure    = Dvector(max_count); 
-                    pitch       = Dvector(max_count); 
-                    roll        = Dvector(max_count); 
-                    heading     = Dvector(max_count); 
-                    temperature = Dvector(max_count); 
-                    battery     = Dvector(max_count); 
+                if (verbose) fprintf(stderr, "0xa5a5 record: %d %d %d %u %f\n", num_beams, num_cells, epoch, pressureInstant, scale); 
+
+                if (take(&c, &pressureAvg, 4) || take(&c, &temperatureAvg, 2)
+                    || take(&c, &headingAvg, 2) || take(&c, &pitchAvg, 2)
+                    || take(&c, &rollAvg, 2) || take(&c, &batteryAvg, 2))
+                    break;
+
+                need = (size_t) num_beams * num_cells * 2;
+                if ((size_t) (c.end - c.p) < need) {
+                    c.p = c.end;
+                    break;
+                }
+                src = c.p;
+                c.p += need;
+
+                // the first ensemble fixes the matrix height; later
+                // ones are cut or zero-filled to fit
+                if (count == 0)
+                    ensCells = num_cells;
+                else if (num_cells != ensCells)
+                    if (reshaped++ == 0)
+                        fprintf(stderr, "WARNING - ensemble %d has %d cells, keeping %d\n",
+                                count, num_cells, ensCells);
+
+                if (count == capEns) {
+                    capEns = NextCap(count, capEns);
+                    for (j = 0 ; j < 3 ; j++)
+                        Reserve(&beamv[j], capEns, ensCells, sizeof(double));
+                    Reserve(&t, capEns, 1, sizeof(double));
+                    Reserve(&pressure, capEns, 1, sizeof(double));
+                    Reserve(&pitch, capEns, 1, sizeof(double));
+                    Reserve(&roll, capEns, 1, sizeof(double));
+                    Reserve(&heading, capEns, 1, sizeof(double));
+                    Reserve(&temperature, capEns, 1, sizeof(double));
+                    Reserve(&battery, capEns, 1, sizeof(double));
                 }
 
                 pressure[count]    = pressureAvg*0.001;
@@ -570,24 +520,28 @@ main(int argc, char *argv[])
                 battery[count]     = batteryAvg*0.001;
 
                 t[count] = epoch;
-            
-                fread(hVel, sizeof(short), num_beams*num_cells, fp);
-
-            
-                for (i = 0 ; i < num_cells ; i ++) {
-                    for (j = 0 ; j < num_beams ; j ++) {
-                        beamv[j][i][count] = scale*hVel[j*num_cells + i];
-                    } 
+
+                ncopy = num_cells < ensCells ? num_cells : ensCells;
+                for (j = 0 ; j < 3 ; j ++) {
+                    v = beamv[j] + (size_t) count * ensCells;
+                    i = 0;
+                    if (j < num_beams) {
+                        for ( ; i < ncopy ; i ++)
+                            v[i] = scale*s16(src + 2*(j*num_cells + i));
+                    }
+                    for ( ; i < ensCells ; i ++)
+                        v[i] = 0;
                 }
                 count ++;
-                tell = ftell(fp);
-                // printf("tell = %ld, count = %d\n", tell, count);
                 continue;
             }
 
-            printf("skipping 1 %x\n", sync);
+            skipped ++;
+            if (verbose)
+                fprintf(stderr, "skipping 1 %x\n", sync);
         }
-        fclose(fp);
+
+        UnmapFile(base, len, mapped);
     }  
     WriteMatlab (argv[argc-1]);
 
@@ -124,7 +124,7 @@ def process_adcp_dat(
         )
         return 1
 
-    cmdline = "%s %s %s" % (convertor, scicon_file, matfile)
+    cmdline = "%s -z %s %s" % (convertor, scicon_file, matfile)
     log_info("Running %s" % cmdline)
     try:
         (sts, _) = Utils.run_cmd_shell(cmdline, timeout=10)
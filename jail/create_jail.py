@@ -101,6 +101,7 @@ def mk_jail(
         "/usr/local/bin/rawrcv2",
         "/usr/local/bin/rawrcvb",
         "/usr/local/bin/rawsend",
+        "/usr/local/bin/rawsendb",
         # For coompressed log and profile for pilot jail
         # "/usr/local/bin/x3decode",
         # "/usr/local/bin/log",
@@ -0,0 +1,167 @@
+// Copyright (c) 2023  University of Washington.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the University of Washington nor the names of its
+//    contributors may be used to endorse or promote products derived from this
+//    software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY OF WASHINGTON AND CONTRIBUTORS “AS
+// IS” AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE UNIVERSITY OF WASHINGTON OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+// GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+// OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/// @file commit.c
+///
+/// Files are received under a temporary name - the file name with a
+/// leading dot (so the processing globs never see it) and a .part
+/// extension - and only renamed into place once the transfer is complete
+/// and its signature checks out.  A failed transfer never leaves a
+/// truncated or corrupt file under the real name, and an earlier good
+/// copy survives a failed resend.
+///
+/// How hard the data is pushed to disk before the rename is set by
+/// RAWRCV_SYNC in the environment: none, data (fdatasync, the default)
+/// or full (fsync, plus an fsync of the directory once renamed).
+
+#define _GNU_SOURCE // for fallocate
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include "commit.h"
+
+static int policy = -1;
+
+static int
+cm_policy(void)
+{
+    char *s;
+
+    if (policy < 0) {
+        s = getenv(CM_SYNC_ENV);
+        if (s && strcmp(s, "none") == 0)
+            policy = CM_SYNC_NONE;
+        else if (s && strcmp(s, "full") == 0)
+            policy = CM_SYNC_FULL;
+        else
+            policy = CM_SYNC_DATA;
+    }
+
+    return policy;
+}
+
+/// Builds the name fname is received under
+void
+cm_tmpname(char *fname, char *tmp, size_t n)
+{
+    char *base;
+
+    if ((base = strrchr(fname, '/')))
+        snprintf(tmp, n, "%.*s.%s.part", (int) (base - fname + 1), fname, base + 1);
+    else
+        snprintf(tmp, n, ".%s.part", fname);
+}
+
+/// Reserves disk for bytes [offset, size) of the file being received,
+/// without changing its length, so running out of space shows up now
+/// rather than part way through and the blocks come out contiguous
+void
+cm_reserve(int fd, unsigned offset, unsigned size)
+{
+    if (size > offset)
+        fallocate(fd, FALLOC_FL_KEEP_SIZE, offset, size - offset);
+}
+
+/// Creates (or truncates) the temporary for fname, room reserved for
+/// size bytes
+/// \return open descriptor, -1 on error
+int
+cm_open(char *fname, unsigned size)
+{
+    char tmp[1024];
+    int  fd;
+
+    cm_tmpname(fname, tmp, sizeof(tmp));
+    if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0666)) >= 0)
+        cm_reserve(fd, 0, size);
+
+    return fd;
+}
+
+/// Syncs (per RAWRCV_SYNC) and closes fd, then renames its temporary
+/// into place as fname
+/// \return 0 on success, errno on failure (the temporary is removed)
+int
+cm_commit(char *fname, int fd)
+{
+    char  tmp[1024];
+    char  dir[1024];
+    char *base;
+    int   err = 0;
+    int   dfd;
+
+    cm_tmpname(fname, tmp, sizeof(tmp));
+
+    if (cm_policy() == CM_SYNC_DATA && fdatasync(fd) != 0)
+        err = errno;
+    else if (cm_policy() == CM_SYNC_FULL && fsync(fd) != 0)
+        err = errno;
+
+    if (close(fd) != 0 && err == 0)
+        err = errno;
+
+    if (err == 0 && rename(tmp, fname) != 0)
+        err = errno;
+
+    if (err) {
+        unlink(tmp);
+        return err;
+    }
+
+    if (cm_policy() == CM_SYNC_FULL) {
+        if ((base = strrchr(fname, '/')))
+            snprintf(dir, sizeof(dir), "%.*s", (int) (base - fname + 1), fname);
+        else
+            strcpy(dir, ".");
+        if ((dfd = open(dir, O_RDONLY | O_DIRECTORY)) >= 0) {
+            fsync(dfd);
+            close(dfd);
+        }
+    }
+
+    return 0;
+}
+
+/// Closes fd without committing.  The temporary is removed unless keep
+/// is set (a partial file held for a resumed transfer).
+void
+cm_abandon(char *fname, int fd, int keep)
+{
+    char tmp[1024];
+
+    if (fd >= 0)
+        close(fd);
+
+    if (!keep) {
+        cm_tmpname(fname, tmp, sizeof(tmp));
+        unlink(tmp);
+    }
+}
@@ -0,0 +1,49 @@
+// Copyright (c) 2023  University of Washington.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the University of Washington nor the names of its
+//    contributors may be used to endorse or promote products derived from this
+//    software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY OF WASHINGTON AND CONTRIBUTORS “AS
+// IS” AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE UNIVERSITY OF WASHINGTON OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+// GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+// OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/// @file commit.h
+///
+/// Receive-to-temp and atomic rename for rawrcv/rawrcvb
+
+#ifndef COMMIT_H
+#define COMMIT_H
+
+#include <stddef.h>
+
+#define CM_SYNC_ENV  "RAWRCV_SYNC"   ///< none, data (the default) or full
+
+#define CM_SYNC_NONE 0    ///< leave it to the kernel
+#define CM_SYNC_DATA 1    ///< fdatasync the file before it is renamed
+#define CM_SYNC_FULL 2    ///< fsync the file, and the directory after the rename
+
+void cm_tmpname(char *fname, char *tmp, size_t n);
+int  cm_open(char *fname, unsigned size);
+void cm_reserve(int fd, unsigned offset, unsigned size);
+int  cm_commit(char *fname, int fd);
+void cm_abandon(char *fname, int fd, int keep);
+
+#endif /* !COMMIT_H */
@@ -0,0 +1,117 @@
+// Copyright (c) 2023  University of Washington.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the University of Washington nor the names of its
+//    contributors may be used to endorse or promote products derived from this
+//    software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY OF WASHINGTON AND CONTRIBUTORS “AS
+// IS” AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE UNIVERSITY OF WASHINGTON OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+// GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+// OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/// @file digest.c
+///
+/// Hex encoding, decoding and comparison of MD5 digests without stdio,
+/// allocation or data dependent branches.  Signatures are accepted in
+/// either case (all 32 characters are folded) and written in lower
+/// case.  Comparisons run over all 16 bytes whatever they hold.
+
+#include <string.h>
+#include "digest.h"
+
+/// Formats digest as 32 lower case hex characters and a NUL into hex
+void
+digest_to_hex(const unsigned char digest[DIGEST_LEN], char *hex)
+{
+    int i, n;
+
+    for (i = 0 ; i < 2 * DIGEST_LEN ; i++) {
+        n = (digest[i >> 1] >> (i & 1 ? 0 : 4)) & 0xf;
+        // 0-9 -> '0'-'9', 10-15 -> 'a'-'f': (9 - n) goes negative
+        // exactly when n is a letter
+        hex[i] = '0' + n + (((9 - n) >> 8) & ('a' - '0' - 10));
+    }
+    hex[2 * DIGEST_LEN] = 0;
+}
+
+/// Value of hex character c (either case) in the low four bits, with
+/// bit 8 set if c is not a hex digit
+static int
+hex_value(int c)
+{
+    int d, l;
+
+    d = c - '0';
+    l = (c | 0x20) - 'a';
+
+    // v lies in [0, k] exactly when neither v nor k - v is negative,
+    // so (v | (k - v)) >> 8 is 0 inside the range and -1 outside it
+    return (d & ~((d | (9 - d)) >> 8))
+           | ((l + 10) & ~((l | (5 - l)) >> 8))
+           | (0x100 & ((d | (9 - d)) >> 8) & ((l | (5 - l)) >> 8));
+}
+
+/// Parses a 32 character hex signature (either case) into digest
+/// \return 0 on success, -1 if hex is not exactly 32 hex characters
+int
+digest_from_hex(const char *hex, unsigned char digest[DIGEST_LEN])
+{
+    int bad = 0;
+    int hi, lo;
+    int i;
+
+    if (hex == NULL || strnlen(hex, 2 * DIGEST_LEN + 1) != 2 * DIGEST_LEN)
+        return -1;
+
+    for (i = 0 ; i < DIGEST_LEN ; i++) {
+        hi = hex_value((unsigned char) hex[2*i]);
+        lo = hex_value((unsigned char) hex[2*i + 1]);
+        bad |= hi | lo;
+        digest[i] = (hi << 4) | (lo & 0xf);
+    }
+
+    return (bad & 0x100) ? -1 : 0;
+}
+
+/// Compares two digests in time independent of their contents
+/// \return 1 if they are equal, 0 if not
+int
+digest_equal(const unsigned char a[DIGEST_LEN], const unsigned char b[DIGEST_LEN])
+{
+    unsigned diff = 0;
+    int      i;
+
+    for (i = 0 ; i < DIGEST_LEN ; i++)
+        diff |= a[i] ^ b[i];
+
+    return diff == 0;
+}
+
+/// Checks a computed digest against the signature the sender supplied
+/// \return 1 if they match, 0 if not (or the signature is malformed)
+int
+digest_verify(const char *hex, const unsigned char digest[DIGEST_LEN])
+{
+    unsigned char expect[DIGEST_LEN];
+
+    if (digest_from_hex(hex, expect))
+        return 0;
+
+    return digest_equal(expect, digest);
+}
@@ -0,0 +1,370 @@
+// Copyright (c) 2023  University of Washington.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the University of Washington nor the names of its
+//    contributors may be used to endorse or promote products derived from this
+//    software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY OF WASHINGTON AND CONTRIBUTORS “AS
+// IS” AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE UNIVERSITY OF WASHINGTON OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+// GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+// OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/// @file inspect.c
+///
+/// With RAWRCV_INSPECT set, rawrcvb runs every gzip (z/g) and bzip2 (j/b)
+/// upload through a streaming decompressor as it arrives.  Fragments
+/// of a file (sg0001dz.x00, .x01, ...) share one decompressor, so each
+/// fragment is checked as a continuation of the ones before it.  Each
+/// fragment that is acknowledged OK gets a line appended to the group's
+/// manifest, .<root>.manifest (a dotfile, so the processing globs never
+/// pick it up):
+///
+///     name size crc32 inflated state
+///
+/// size and crc32 are of the fragment as received.  inflated is the
+/// total decompressed from the start of the group to the end of this
+/// fragment.  state is one of
+///     prefix   - everything so far is a valid start of a stream
+///     complete - the stream ended exactly at the end of this fragment
+///     trailing - the stream ended with bytes left over
+///     bad      - the data is not a valid stream
+///     unknown  - not checked (an earlier fragment is missing, the
+///                transfer was resumed part way through, ...)
+///
+/// The manifest is rewritten (through a temporary and a rename) each
+/// time, dropping any earlier line for the same name, so a resent
+/// fragment replaces its old line and the file stays at one line per
+/// fragment.  Base.py uses the manifest to choose between a whole
+/// upload and its fragments without decompressing both.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <zlib.h>
+#include <bzlib.h>
+#include "inspect.h"
+
+enum { INS_NONE, INS_GZIP, INS_BZIP };
+enum { INS_PREFIX, INS_COMPLETE, INS_TRAILING, INS_BAD, INS_UNKNOWN };
+
+static char *states[] = { "prefix", "complete", "trailing", "bad", "unknown" };
+
+/// One group of fragments - only one is followed at a time, as the
+/// glider sends a file's fragments one after the other
+typedef struct {
+    char          root[16];   ///< file name up to the extension
+    int           kind;
+    int           next;       ///< fragment expected to continue the stream
+    int           state;
+    unsigned long inflated;
+    z_stream      z;
+    bz_stream     bz;
+    int           open;       ///< z or bz is initialized
+
+    // the fragment in progress
+    char          name[16];
+    unsigned      size;
+    unsigned long crc;
+    int           active;
+
+    // where the group stood before it, for when it fails
+    z_stream      zsave;
+    int           saved;
+    int           state_save;
+    unsigned long inflated_save;
+} Group;
+
+static Group          group;
+static int            enabled = -1;
+static unsigned char *scratch = NULL;
+
+static void
+ins_close(void)
+{
+    if (group.open) {
+        if (group.kind == INS_GZIP)
+            inflateEnd(&group.z);
+        else
+            BZ2_bzDecompressEnd(&group.bz);
+        group.open = 0;
+    }
+    if (group.saved) {
+        inflateEnd(&group.zsave);
+        group.saved = 0;
+    }
+}
+
+static int
+ins_open(void)
+{
+    memset(&group.z, 0, sizeof(group.z));
+    memset(&group.bz, 0, sizeof(group.bz));
+
+    if (group.kind == INS_GZIP)
+        group.open = inflateInit2(&group.z, 15 + 16) == Z_OK;
+    else
+        group.open = BZ2_bzDecompressInit(&group.bz, 0, 0) == BZ_OK;
+
+    return group.open;
+}
+
+/// Starts on fname, offset bytes of which are already on hand from an
+/// earlier (resumed) transfer
+void
+ins_begin(char *fname, unsigned offset)
+{
+    char *ext;
+    int   kind;
+    int   counter;
+    int   len;
+
+    if (enabled < 0) {
+        enabled = getenv(INS_ENV) != NULL;
+        if (enabled && (scratch = malloc(INS_SCRATCH)) == NULL)
+            enabled = 0;
+    }
+
+    group.active = 0;
+    if (!enabled)
+        return;
+
+    // sg0001dz.x00 - the 8th character says how it is compressed and
+    // the two after the .x count the fragments (.x alone is the whole
+    // file)
+    if (strlen(fname) < 10 || (ext = strrchr(fname, '.')) == NULL
+        || ext - fname != 8 || (ext[1] != 'x' && ext[1] != 'X'))
+        return;
+    if (fname[7] == 'z' || fname[7] == 'g')
+        kind = INS_GZIP;
+    else if (fname[7] == 'j' || fname[7] == 'b')
+        kind = INS_BZIP;
+    else
+        return;
+
+    len = strlen(ext);
+    if (len == 2)
+        counter = -1;
+    else if (len == 4 && sscanf(ext + 2, "%2x", &counter) == 1)
+        ;
+    else
+        return;
+
+    if (counter <= 0 || offset || kind != group.kind
+        || strncmp(fname, group.root, 8) || counter != group.next) {
+        // not a continuation of what we have - start over
+        ins_close();
+        memset(group.root, 0, sizeof(group.root));
+        memcpy(group.root, fname, 8);
+        group.kind = kind;
+        group.inflated = 0;
+        group.state = INS_UNKNOWN;
+        if (counter <= 0 && offset == 0 && ins_open())
+            group.state = INS_PREFIX;
+    }
+    group.next = counter < 0 ? -2 : counter + 1;
+
+    strncpy(group.name, fname, sizeof(group.name) - 1);
+    group.size = 0;
+    group.crc = crc32(0L, Z_NULL, 0);
+    group.active = 1;
+
+    group.state_save = group.state;
+    group.inflated_save = group.inflated;
+    if (group.open && group.kind == INS_GZIP)
+        group.saved = inflateCopy(&group.zsave, &group.z) == Z_OK;
+}
+
+static void
+ins_gzip(unsigned char *data, unsigned n)
+{
+    int r;
+
+    group.z.next_in = data;
+    group.z.avail_in = n;
+    do {
+        group.z.next_out = scratch;
+        group.z.avail_out = INS_SCRATCH;
+        r = inflate(&group.z, Z_NO_FLUSH);
+        group.inflated += INS_SCRATCH - group.z.avail_out;
+        if (r == Z_STREAM_END) {
+            group.state = group.z.avail_in ? INS_TRAILING : INS_COMPLETE;
+            return;
+        }
+        if (r != Z_OK && r != Z_BUF_ERROR) {
+            group.state = INS_BAD;
+            return;
+        }
+    } while (group.z.avail_in || group.z.avail_out == 0);
+}
+
+static void
+ins_bzip(unsigned char *data, unsigned n)
+{
+    int r;
+
+    group.bz.next_in = (char *) data;
+    group.bz.avail_in = n;
+    do {
+        group.bz.next_out = (char *) scratch;
+        group.bz.avail_out = INS_SCRATCH;
+        r = BZ2_bzDecompress(&group.bz);
+        group.inflated += INS_SCRATCH - group.bz.avail_out;
+        if (r == BZ_STREAM_END) {
+            group.state = group.bz.avail_in ? INS_TRAILING : INS_COMPLETE;
+            return;
+        }
+        if (r != BZ_OK) {
+            group.state = INS_BAD;
+            return;
+        }
+    } while (group.bz.avail_in || group.bz.avail_out == 0);
+}
+
+/// Takes the next n bytes of the file begun with ins_begin
+void
+ins_feed(unsigned char *data, unsigned n)
+{
+    if (!group.active)
+        return;
+
+    group.size += n;
+    group.crc = crc32(group.crc, data, n);
+
+    if (group.state == INS_COMPLETE && n)
+        group.state = INS_TRAILING;
+    if (group.state != INS_PREFIX)
+        return;
+
+    if (group.kind == INS_GZIP)
+        ins_gzip(data, n);
+    else
+        ins_bzip(data, n);
+}
+
+/// Rewrites manifest with line in place of any earlier line for name
+static void
+ins_record(char *manifest, char *name, char *line)
+{
+    char   tmp[40];
+    char   buf[128];
+    FILE  *in;
+    FILE  *out;
+    size_t len = strlen(name);
+    int    err;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", manifest);
+    if ((out = fopen(tmp, "w")) == NULL)
+        return;
+
+    if ((in = fopen(manifest, "r"))) {
+        while (fgets(buf, sizeof(buf), in))
+            if (strncmp(buf, name, len) != 0 || buf[len] != ' ')
+                fputs(buf, out);
+        fclose(in);
+    }
+    fputs(line, out);
+
+    err = ferror(out);
+    if (fclose(out) != 0 || err || rename(tmp, manifest) != 0)
+        unlink(tmp);
+}
+
+/// Finishes the file begun with ins_begin - recording it in the manifest
+/// if it was received OK, or setting the group back to where it was
+/// before it if not
+void
+ins_end(int ok)
+{
+    char  manifest[32];
+    char  line[128];
+
+    if (!group.active)
+        return;
+    group.active = 0;
+
+    if (!ok) {
+        if (group.saved) {
+            inflateEnd(&group.z);
+            if (inflateCopy(&group.z, &group.zsave) == Z_OK) {
+                group.state = group.state_save;
+                group.inflated = group.inflated_save;
+            }
+            else {
+                group.open = 0;
+                group.state = INS_UNKNOWN;
+            }
+            inflateEnd(&group.zsave);
+            group.saved = 0;
+        }
+        else if (group.open) {
+            // bzip2 state can't be copied - the rest of the group
+            // goes unchecked
+            ins_close();
+            group.state = INS_UNKNOWN;
+        }
+        else {
+            group.state = group.state_save;
+            group.inflated = group.inflated_save;
+        }
+        group.next --;
+        return;
+    }
+
+    if (group.saved) {
+        inflateEnd(&group.zsave);
+        group.saved = 0;
+    }
+
+    snprintf(manifest, sizeof(manifest), ".%s.manifest", group.root);
+    snprintf(line, sizeof(line), "%s %u %08lx %lu %s\n", group.name, group.size,
+             group.crc, group.inflated, states[group.state]);
+    ins_record(manifest, group.name, line);
+
+    if (group.state != INS_PREFIX)
+        ins_close();
+}
+
+/// Inspects a file already committed as fname, reading it back - for the
+/// windowed receiver, whose bodies go to disk before their verdicts
+void
+ins_file(char *fname)
+{
+    static unsigned char *buf;
+    ssize_t               n;
+    int                   fd;
+    int                   bad = 0;
+
+    ins_begin(fname, 0);
+    if (!group.active)
+        return;
+
+    if ((buf == NULL && (buf = malloc(INS_SCRATCH)) == NULL)
+        || (fd = open(fname, O_RDONLY)) < 0) {
+        ins_end(0);
+        return;
+    }
+    while ((n = read(fd, buf, INS_SCRATCH)) > 0)
+        ins_feed(buf, n);
+    if (n < 0)
+        bad = 1;
+    close(fd);
+    ins_end(!bad);
+}
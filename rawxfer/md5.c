@@ -30,17 +30,26 @@
 #include	<ctype.h>
 #include	<time.h>
 #include	<sys/stat.h>
+#include	<sys/mman.h>
+#include	<fcntl.h>
 #include	<unistd.h>
 #include "md5.h"
+#include "digest.h"
 
+#if defined(__x86_64__) || defined(__i386__)
+#define MD5_MULTI_AVX2
+#include <immintrin.h>
+#endif
+
+/// MD5 works on little-endian words, so only big-endian hosts have any
+/// byte swapping to do
+#if !defined(__BYTE_ORDER__) || __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
 #define HIGHFIRST
+#endif
 
 #ifndef HIGHFIRST
 #define byteReverse(buf, len)   /* Nothing */
 #else
-/*
- * Note: this code is harmless on little-endian machines.
- */
 //void byteReverse(unsigned char *buf, unsigned longs)
 void byteReverse(unsigned char *buf, uint32 longs)
 {
@@ -68,20 +77,31 @@ void MD5Init(struct MD5Context *ctx)
 }
 
 
-/// Update context to reflect the concatenation of another buffer full
-/// of bytes.
-void MD5Update(struct MD5Context *ctx, unsigned char *buf, unsigned len)
+static void md5_blocks(uint32 buf[4], const unsigned char *data, size_t nblocks);
+
+/// Adds len bytes to the context's bit count
+static void
+md5_count(struct MD5Context *ctx, unsigned len)
 {
     uint32 t;
 
-    /* Update bitcount */
-
     t = ctx->bits[0];
     if ((ctx->bits[0] = t + ((uint32) len << 3)) < t)
         ctx->bits[1]++;     /* Carry from low to high */
     ctx->bits[1] += len >> 29;
+}
 
-    t = (t >> 3) & 0x3f;    /* Bytes already in shsInfo->data */
+/// Update context to reflect the concatenation of another buffer full
+/// of bytes.
+void MD5Update(struct MD5Context *ctx, unsigned char *buf, unsigned len)
+{
+    uint32 t;
+
+    t = (ctx->bits[0] >> 3) & 0x3f;    /* Bytes already in shsInfo->data */
+
+    /* Update bitcount */
+
+    md5_count(ctx, len);
 
     /* Handle any leading odd-sized chunks */
 
@@ -94,23 +114,17 @@ void MD5Update(struct MD5Context *ctx, unsigned char *buf, unsigned len)
             return;
         }
         memcpy(p, buf, (size_t)t);
-        byteReverse(ctx->in, 16);
-        MD5Transform(ctx->buf, (uint32 *) ctx->in);
+        md5_blocks(ctx->buf, ctx->in, 1);
         buf += t;
         len -= t;
     }
-    /* Process data in 64-byte chunks */
 
-    while (len >= 64) {
+    /* Process data in 64-byte chunks, straight from the caller's buffer */
 
-        // GBS - 7/5/2016 The intrinsic generate by gcc under -O2 does not handle
-        // unalinged input data - thus the hand coding
-        //memcpy(ctx->in, buf, (size_t)64);
-        for(int ii = 0; ii < 64; ii++) ctx->in[ii] = buf[ii];
-        byteReverse(ctx->in, 16);
-        MD5Transform(ctx->buf, (uint32 *) ctx->in);
-        buf += 64;
-        len -= 64;
+    if (len >= 64) {
+        md5_blocks(ctx->buf, buf, len / 64);
+        buf += len & ~63;
+        len &= 63;
     }
 
     /* Handle any remaining bytes of data. */
@@ -166,7 +180,7 @@ void MD5Final(unsigned char digest[16], struct MD5Context *ctx)
 
 //#define F1(x, y, z) (x & y | ~x & z)
 #define F1(x, y, z) (z ^ (x & (y ^ z)))
-#define F2(x, y, z) F1(z, x, y)
+#define F2(x, y, z) ((x & z) + (y & ~z))   // the two terms never share a bit
 #define F3(x, y, z) (x ^ y ^ z)
 #define F4(x, y, z) (y ^ (x | ~z))
 
@@ -174,9 +188,81 @@ void MD5Final(unsigned char digest[16], struct MD5Context *ctx)
 #define MD5STEP(f, w, x, y, z, data, s) \
     ( w += f(x, y, z) + data,  w = w<<s | w>>(32-s),  w += x )
 
+/// The 64 steps, as STEP(function, registers, message word, constant,
+/// shift), shared by the single stream and the multi-buffer transforms
+#define MD5_STEPS(STEP) \
+    STEP(F1, a, b, c, d, 0, 0xd76aa478, 7); \
+    STEP(F1, d, a, b, c, 1, 0xe8c7b756, 12); \
+    STEP(F1, c, d, a, b, 2, 0x242070db, 17); \
+    STEP(F1, b, c, d, a, 3, 0xc1bdceee, 22); \
+    STEP(F1, a, b, c, d, 4, 0xf57c0faf, 7); \
+    STEP(F1, d, a, b, c, 5, 0x4787c62a, 12); \
+    STEP(F1, c, d, a, b, 6, 0xa8304613, 17); \
+    STEP(F1, b, c, d, a, 7, 0xfd469501, 22); \
+    STEP(F1, a, b, c, d, 8, 0x698098d8, 7); \
+    STEP(F1, d, a, b, c, 9, 0x8b44f7af, 12); \
+    STEP(F1, c, d, a, b, 10, 0xffff5bb1, 17); \
+    STEP(F1, b, c, d, a, 11, 0x895cd7be, 22); \
+    STEP(F1, a, b, c, d, 12, 0x6b901122, 7); \
+    STEP(F1, d, a, b, c, 13, 0xfd987193, 12); \
+    STEP(F1, c, d, a, b, 14, 0xa679438e, 17); \
+    STEP(F1, b, c, d, a, 15, 0x49b40821, 22); \
+    \
+    STEP(F2, a, b, c, d, 1, 0xf61e2562, 5); \
+    STEP(F2, d, a, b, c, 6, 0xc040b340, 9); \
+    STEP(F2, c, d, a, b, 11, 0x265e5a51, 14); \
+    STEP(F2, b, c, d, a, 0, 0xe9b6c7aa, 20); \
+    STEP(F2, a, b, c, d, 5, 0xd62f105d, 5); \
+    STEP(F2, d, a, b, c, 10, 0x02441453, 9); \
+    STEP(F2, c, d, a, b, 15, 0xd8a1e681, 14); \
+    STEP(F2, b, c, d, a, 4, 0xe7d3fbc8, 20); \
+    STEP(F2, a, b, c, d, 9, 0x21e1cde6, 5); \
+    STEP(F2, d, a, b, c, 14, 0xc33707d6, 9); \
+    STEP(F2, c, d, a, b, 3, 0xf4d50d87, 14); \
+    STEP(F2, b, c, d, a, 8, 0x455a14ed, 20); \
+    STEP(F2, a, b, c, d, 13, 0xa9e3e905, 5); \
+    STEP(F2, d, a, b, c, 2, 0xfcefa3f8, 9); \
+    STEP(F2, c, d, a, b, 7, 0x676f02d9, 14); \
+    STEP(F2, b, c, d, a, 12, 0x8d2a4c8a, 20); \
+    \
+    STEP(F3, a, b, c, d, 5, 0xfffa3942, 4); \
+    STEP(F3, d, a, b, c, 8, 0x8771f681, 11); \
+    STEP(F3, c, d, a, b, 11, 0x6d9d6122, 16); \
+    STEP(F3, b, c, d, a, 14, 0xfde5380c, 23); \
+    STEP(F3, a, b, c, d, 1, 0xa4beea44, 4); \
+    STEP(F3, d, a, b, c, 4, 0x4bdecfa9, 11); \
+    STEP(F3, c, d, a, b, 7, 0xf6bb4b60, 16); \
+    STEP(F3, b, c, d, a, 10, 0xbebfbc70, 23); \
+    STEP(F3, a, b, c, d, 13, 0x289b7ec6, 4); \
+    STEP(F3, d, a, b, c, 0, 0xeaa127fa, 11); \
+    STEP(F3, c, d, a, b, 3, 0xd4ef3085, 16); \
+    STEP(F3, b, c, d, a, 6, 0x04881d05, 23); \
+    STEP(F3, a, b, c, d, 9, 0xd9d4d039, 4); \
+    STEP(F3, d, a, b, c, 12, 0xe6db99e5, 11); \
+    STEP(F3, c, d, a, b, 15, 0x1fa27cf8, 16); \
+    STEP(F3, b, c, d, a, 2, 0xc4ac5665, 23); \
+    \
+    STEP(F4, a, b, c, d, 0, 0xf4292244, 6); \
+    STEP(F4, d, a, b, c, 7, 0x432aff97, 10); \
+    STEP(F4, c, d, a, b, 14, 0xab9423a7, 15); \
+    STEP(F4, b, c, d, a, 5, 0xfc93a039, 21); \
+    STEP(F4, a, b, c, d, 12, 0x655b59c3, 6); \
+    STEP(F4, d, a, b, c, 3, 0x8f0ccc92, 10); \
+    STEP(F4, c, d, a, b, 10, 0xffeff47d, 15); \
+    STEP(F4, b, c, d, a, 1, 0x85845dd1, 21); \
+    STEP(F4, a, b, c, d, 8, 0x6fa87e4f, 6); \
+    STEP(F4, d, a, b, c, 15, 0xfe2ce6e0, 10); \
+    STEP(F4, c, d, a, b, 6, 0xa3014314, 15); \
+    STEP(F4, b, c, d, a, 13, 0x4e0811a1, 21); \
+    STEP(F4, a, b, c, d, 4, 0xf7537e82, 6); \
+    STEP(F4, d, a, b, c, 11, 0xbd3af235, 10); \
+    STEP(F4, c, d, a, b, 2, 0x2ad7d2bb, 15); \
+    STEP(F4, b, c, d, a, 9, 0xeb86d391, 21)
+
+#define WORDSTEP(f, w, x, y, z, i, k, s) MD5STEP(f, w, x, y, z, in[i] + k, s)
 
 /// The core of the MD5 algorithm, this alters an existing MD5 hash to
-/// reflect the addition of 16 longwords of new data.  MD5Update blocks
+/// reflect the addition of 16 longwords of new data.  MD5Final blocks
 /// the data and converts bytes into longwords for this routine.
 void MD5Transform(uint32 buf[4], uint32 in[16])
 {
@@ -187,73 +273,7 @@ void MD5Transform(uint32 buf[4], uint32 in[16])
     c = buf[2];
     d = buf[3];
 
-    MD5STEP(F1, a, b, c, d, in[0] + 0xd76aa478, 7);
-    MD5STEP(F1, d, a, b, c, in[1] + 0xe8c7b756, 12);
-    MD5STEP(F1, c, d, a, b, in[2] + 0x242070db, 17);
-    MD5STEP(F1, b, c, d, a, in[3] + 0xc1bdceee, 22);
-    MD5STEP(F1, a, b, c, d, in[4] + 0xf57c0faf, 7);
-    MD5STEP(F1, d, a, b, c, in[5] + 0x4787c62a, 12);
-    MD5STEP(F1, c, d, a, b, in[6] + 0xa8304613, 17);
-    MD5STEP(F1, b, c, d, a, in[7] + 0xfd469501, 22);
-    MD5STEP(F1, a, b, c, d, in[8] + 0x698098d8, 7);
-    MD5STEP(F1, d, a, b, c, in[9] + 0x8b44f7af, 12);
-    MD5STEP(F1, c, d, a, b, in[10] + 0xffff5bb1, 17);
-    MD5STEP(F1, b, c, d, a, in[11] + 0x895cd7be, 22);
-    MD5STEP(F1, a, b, c, d, in[12] + 0x6b901122, 7);
-    MD5STEP(F1, d, a, b, c, in[13] + 0xfd987193, 12);
-    MD5STEP(F1, c, d, a, b, in[14] + 0xa679438e, 17);
-    MD5STEP(F1, b, c, d, a, in[15] + 0x49b40821, 22);
-
-    MD5STEP(F2, a, b, c, d, in[1] + 0xf61e2562, 5);
-    MD5STEP(F2, d, a, b, c, in[6] + 0xc040b340, 9);
-    MD5STEP(F2, c, d, a, b, in[11] + 0x265e5a51, 14);
-    MD5STEP(F2, b, c, d, a, in[0] + 0xe9b6c7aa, 20);
-    MD5STEP(F2, a, b, c, d, in[5] + 0xd62f105d, 5);
-    MD5STEP(F2, d, a, b, c, in[10] + 0x02441453, 9);
-    MD5STEP(F2, c, d, a, b, in[15] + 0xd8a1e681, 14);
-    MD5STEP(F2, b, c, d, a, in[4] + 0xe7d3fbc8, 20);
-    MD5STEP(F2, a, b, c, d, in[9] + 0x21e1cde6, 5);
-    MD5STEP(F2, d, a, b, c, in[14] + 0xc33707d6, 9);
-    MD5STEP(F2, c, d, a, b, in[3] + 0xf4d50d87, 14);
-    MD5STEP(F2, b, c, d, a, in[8] + 0x455a14ed, 20);
-    MD5STEP(F2, a, b, c, d, in[13] + 0xa9e3e905, 5);
-    MD5STEP(F2, d, a, b, c, in[2] + 0xfcefa3f8, 9);
-    MD5STEP(F2, c, d, a, b, in[7] + 0x676f02d9, 14);
-    MD5STEP(F2, b, c, d, a, in[12] + 0x8d2a4c8a, 20);
-
-    MD5STEP(F3, a, b, c, d, in[5] + 0xfffa3942, 4);
-    MD5STEP(F3, d, a, b, c, in[8] + 0x8771f681, 11);
-    MD5STEP(F3, c, d, a, b, in[11] + 0x6d9d6122, 16);
-    MD5STEP(F3, b, c, d, a, in[14] + 0xfde5380c, 23);
-    MD5STEP(F3, a, b, c, d, in[1] + 0xa4beea44, 4);
-    MD5STEP(F3, d, a, b, c, in[4] + 0x4bdecfa9, 11);
-    MD5STEP(F3, c, d, a, b, in[7] + 0xf6bb4b60, 16);
-    MD5STEP(F3, b, c, d, a, in[10] + 0xbebfbc70, 23);
-    MD5STEP(F3, a, b, c, d, in[13] + 0x289b7ec6, 4);
-    MD5STEP(F3, d, a, b, c, in[0] + 0xeaa127fa, 11);
-    MD5STEP(F3, c, d, a, b, in[3] + 0xd4ef3085, 16);
-    MD5STEP(F3, b, c, d, a, in[6] + 0x04881d05, 23);
-    MD5STEP(F3, a, b, c, d, in[9] + 0xd9d4d039, 4);
-    MD5STEP(F3, d, a, b, c, in[12] + 0xe6db99e5, 11);
-    MD5STEP(F3, c, d, a, b, in[15] + 0x1fa27cf8, 16);
-    MD5STEP(F3, b, c, d, a, in[2] + 0xc4ac5665, 23);
-
-    MD5STEP(F4, a, b, c, d, in[0] + 0xf4292244, 6);
-    MD5STEP(F4, d, a, b, c, in[7] + 0x432aff97, 10);
-    MD5STEP(F4, c, d, a, b, in[14] + 0xab9423a7, 15);
-    MD5STEP(F4, b, c, d, a, in[5] + 0xfc93a039, 21);
-    MD5STEP(F4, a, b, c, d, in[12] + 0x655b59c3, 6);
-    MD5STEP(F4, d, a, b, c, in[3] + 0x8f0ccc92, 10);
-    MD5STEP(F4, c, d, a, b, in[10] + 0xffeff47d, 15);
-    MD5STEP(F4, b, c, d, a, in[1] + 0x85845dd1, 21);
-    MD5STEP(F4, a, b, c, d, in[8] + 0x6fa87e4f, 6);
-    MD5STEP(F4, d, a, b, c, in[15] + 0xfe2ce6e0, 10);
-    MD5STEP(F4, c, d, a, b, in[6] + 0xa3014314, 15);
-    MD5STEP(F4, b, c, d, a, in[13] + 0x4e0811a1, 21);
-    MD5STEP(F4, a, b, c, d, in[4] + 0xf7537e82, 6);
-    MD5STEP(F4, d, a, b, c, in[11] + 0xbd3af235, 10);
-    MD5STEP(F4, c, d, a, b, in[2] + 0x2ad7d2bb, 15);
-    MD5STEP(F4, b, c, d, a, in[9] + 0xeb86d391, 21);
+    MD5_STEPS(WORDSTEP);
 
     buf[0] += a;
     buf[1] += b;
@@ -261,68 +281,257 @@ void MD5Transform(uint32 buf[4], uint32 in[16])
     buf[3] += d;
 }
 
-/// Compares two MD5 hashes
+/// Runs nblocks consecutive 64 byte blocks straight out of the caller's
+/// buffer (any alignment) through the transform, keeping the state in
+/// registers from one block to the next
+static void
+md5_blocks(uint32 buf[4], const unsigned char *data, size_t nblocks)
+{
+    register uint32 a, b, c, d;
+    uint32 in[16];
+#ifdef HIGHFIRST
+    int i;
+#endif
+
+    a = buf[0];
+    b = buf[1];
+    c = buf[2];
+    d = buf[3];
+
+    while (nblocks--) {
+#ifdef HIGHFIRST
+        for (i = 0 ; i < 16 ; i++)
+            in[i] = (uint32) data[4*i] | (uint32) data[4*i+1] << 8
+                    | (uint32) data[4*i+2] << 16 | (uint32) data[4*i+3] << 24;
+#else
+        memcpy(in, data, 64);
+#endif
+        MD5_STEPS(WORDSTEP);
+
+        a = buf[0] += a;
+        b = buf[1] += b;
+        c = buf[2] += c;
+        d = buf[3] += d;
+        data += 64;
+    }
+}
+
+#ifdef MD5_MULTI_AVX2
+
+#define V_F1(x, y, z) _mm256_xor_si256(z, _mm256_and_si256(x, _mm256_xor_si256(y, z)))
+#define V_F2(x, y, z) V_F1(z, x, y)
+#define V_F3(x, y, z) _mm256_xor_si256(x, _mm256_xor_si256(y, z))
+#define V_F4(x, y, z) _mm256_xor_si256(y, _mm256_or_si256(x, _mm256_xor_si256(z, ones)))
+
+#define V_STEP(f, w, x, y, z, i, k, s) \
+    ( w = _mm256_add_epi32(w, _mm256_add_epi32(V_##f(x, y, z), \
+                               _mm256_add_epi32(in[i], _mm256_set1_epi32(k)))), \
+      w = _mm256_or_si256(_mm256_slli_epi32(w, s), _mm256_srli_epi32(w, 32 - (s))), \
+      w = _mm256_add_epi32(w, x) )
+
+static inline uint32
+lane_word(const unsigned char *p, int i)
+{
+    uint32 w;
+
+    memcpy(&w, p + 4*i, 4);
+    return w;
+}
+
+/// The same transform as md5_blocks, run on eight independent streams
+/// at once, one per 32 bit lane of an AVX2 register.  state[j][lane]
+/// holds word j of each stream's hash.
+__attribute__((target("avx2")))
+static void
+md5_blocks_x8(uint32 state[4][8], const unsigned char *data[8], size_t nblocks)
+{
+    __m256i a, b, c, d, aa, bb, cc, dd;
+    __m256i in[16];
+    __m256i ones = _mm256_set1_epi32(-1);
+    const unsigned char *p[8];
+    int i;
+
+    memcpy(p, data, sizeof(p));
+    a = _mm256_loadu_si256((__m256i *) state[0]);
+    b = _mm256_loadu_si256((__m256i *) state[1]);
+    c = _mm256_loadu_si256((__m256i *) state[2]);
+    d = _mm256_loadu_si256((__m256i *) state[3]);
+
+    while (nblocks--) {
+        for (i = 0 ; i < 16 ; i++)
+            in[i] = _mm256_set_epi32(lane_word(p[7], i), lane_word(p[6], i),
+                                     lane_word(p[5], i), lane_word(p[4], i),
+                                     lane_word(p[3], i), lane_word(p[2], i),
+                                     lane_word(p[1], i), lane_word(p[0], i));
+        aa = a;
+        bb = b;
+        cc = c;
+        dd = d;
+
+        MD5_STEPS(V_STEP);
+
+        a = _mm256_add_epi32(a, aa);
+        b = _mm256_add_epi32(b, bb);
+        c = _mm256_add_epi32(c, cc);
+        d = _mm256_add_epi32(d, dd);
+
+        for (i = 0 ; i < 8 ; i++)
+            p[i] += 64;
+    }
+
+    _mm256_storeu_si256((__m256i *) state[0], a);
+    _mm256_storeu_si256((__m256i *) state[1], b);
+    _mm256_storeu_si256((__m256i *) state[2], c);
+    _mm256_storeu_si256((__m256i *) state[3], d);
+}
+
+#endif
+
+/// Hashes n independent buffers.  On CPUs with AVX2 up to eight of them
+/// go through the transform together for as many whole blocks as they
+/// have in common, then each is finished on its own.
+void
+md5_multi(int n, unsigned char *data[], unsigned len[], unsigned char digest[][16])
+{
+    struct MD5Context ctx[MD5_LANES];
+    unsigned char    *p[MD5_LANES];
+    unsigned          left[MD5_LANES];
+    int               base, lanes, i;
+#ifdef MD5_MULTI_AVX2
+    static int        avx2 = -1;
+    uint32            state[4][8];
+    const unsigned char *lp[8];
+    unsigned          nblocks;
+    int               active, first, j;
+
+    if (avx2 < 0) {
+        __builtin_cpu_init();
+        avx2 = __builtin_cpu_supports("avx2");
+    }
+#endif
+
+    for (base = 0 ; base < n ; base += MD5_LANES) {
+        lanes = n - base < MD5_LANES ? n - base : MD5_LANES;
+        for (i = 0 ; i < lanes ; i++) {
+            MD5Init(&ctx[i]);
+            p[i] = data[base + i];
+            left[i] = len[base + i];
+        }
+
+#ifdef MD5_MULTI_AVX2
+        while (avx2) {
+            // the lanes that still have whole blocks, and how many
+            // they all have
+            active = 0;
+            first = -1;
+            nblocks = 0;
+            for (i = 0 ; i < lanes ; i++) {
+                if (left[i] >= 64) {
+                    if (first < 0)
+                        first = i;
+                    if (active == 0 || left[i] / 64 < nblocks)
+                        nblocks = left[i] / 64;
+                    active ++;
+                }
+            }
+            if (active < 2)
+                break;
+
+            // idle lanes rerun an active one and are thrown away
+            for (i = 0 ; i < 8 ; i++) {
+                j = i < lanes && left[i] >= 64 ? i : first;
+                lp[i] = p[j];
+                state[0][i] = ctx[j].buf[0];
+                state[1][i] = ctx[j].buf[1];
+                state[2][i] = ctx[j].buf[2];
+                state[3][i] = ctx[j].buf[3];
+            }
+
+            md5_blocks_x8(state, lp, nblocks);
+
+            for (i = 0 ; i < lanes ; i++) {
+                if (left[i] >= 64) {
+                    ctx[i].buf[0] = state[0][i];
+                    ctx[i].buf[1] = state[1][i];
+                    ctx[i].buf[2] = state[2][i];
+                    ctx[i].buf[3] = state[3][i];
+                    md5_count(&ctx[i], nblocks * 64);
+                    p[i] += nblocks * 64;
+                    left[i] -= nblocks * 64;
+                }
+            }
+        }
+#endif
+
+        for (i = 0 ; i < lanes ; i++) {
+            MD5Update(&ctx[i], p[i], left[i]);
+            MD5Final(digest[base + i], &ctx[i]);
+        }
+    }
+}
+
+/// Compares two MD5 hashes (in either case)
 /// \return 0 if they are equal, non-zero if they are not
 int
 md5_compare(char *sig1,
             char *sig2)
 {
-    char csig1[16];
-    char csig2[16];
-    char *clabel1;
-    char *clabel2;
-    int j;
-    char *hexfmt = "%02x"; // assume (coerce) signature to lower case
-    unsigned int bp;
-
-    if(!sig1 || !sig2) {
-        return -1;
-    }
+    unsigned char csig1[DIGEST_LEN];
+    unsigned char csig2[DIGEST_LEN];
 
-    if (strlen(sig1) != 32 || strlen(sig2) != 32) {
+    if (digest_from_hex(sig1, csig1) || digest_from_hex(sig2, csig2)) {
         return -1;
     }
-    
-    for (j = 0; j < 31; j++) {
-        sig1[j] = tolower((unsigned char)sig1[j]);
-        sig2[j] = tolower((unsigned char)sig2[j]);
-    }
-    
-    memset(csig1, 0, (size_t)16);
-    memset(csig1, 0, (size_t)16);
-    
-    clabel1 = sig1;
-    clabel2 = sig2;
-    
-    for (j = 0; j < 16; j++) {
-        if (isxdigit((int) clabel1[0]) && isxdigit((int) clabel1[1]) &&
-            sscanf((sig1 + (j * 2)), hexfmt, &bp) == 1) {
-            csig1[j] = (unsigned char) bp;
-        } else {
-            return -1;
-        }
-        clabel1 += 2;
 
-        if (isxdigit((int) clabel2[0]) && isxdigit((int) clabel2[1]) &&
-            sscanf((sig2 + (j * 2)), hexfmt, &bp) == 1) {
-            csig2[j] = (unsigned char) bp;
-        } else {
-            return -1;
-        }
-        clabel2 += 2;
+    return digest_equal(csig1, csig2) ? 0 : -1;
+}
+
+
+/// Formats a 16 byte digest as a 32 character lower case signature
+void
+md5_signature(unsigned char digest[16],
+              char *output_sig)
+{
+    digest_to_hex(digest, output_sig);
+}
+
+/// Maps a whole file for reading (NULL and *size 0 for an empty file)
+/// \return 0 on success, 1 on failure
+static int
+md5_map(char *filename, unsigned char **data, unsigned *size)
+{
+    struct stat statbuf;
+    int fd;
+
+    *data = NULL;
+    *size = 0;
+
+    if ((fd = open(filename, O_RDONLY)) < 0)
+        return 1;
+
+    if (fstat(fd, &statbuf) != 0 || !S_ISREG(statbuf.st_mode)) {
+        close(fd);
+        return 1;
     }
-    
-    for (j = 0; j < sizeof(csig1); j++) {
-        if (csig1[j] != csig2[j]) {
-            return -1;
+
+    if (statbuf.st_size > 0) {
+        *data = mmap(NULL, statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (*data == MAP_FAILED) {
+            *data = NULL;
+            close(fd);
+            return 1;
         }
+        madvise(*data, statbuf.st_size, MADV_SEQUENTIAL | MADV_WILLNEED);
+        *size = statbuf.st_size;
     }
+
+    close(fd);
     return 0;
 }
 
-
-/// Computes the signature from the file
-/// \return 
+/// Computes the signature from the file.  Regular files are mapped and
+/// hashed in one pass, anything else is read in MD5_COPY_BUFF pieces.
+/// \return 0 on success, 1 on failure
 int
 md5_compute(char *filename,
             char *output_sig)
@@ -330,17 +539,26 @@ md5_compute(char *filename,
     FILE *in = NULL;
     struct MD5Context md5c;
     char signature[16];
-    char *hexfmt = "%02x"; // assume (coerce) signature to lower case
-    int j;
     long bytes = 0;
-    char buff[4];
     int retval = 1;
     char *in_buff = NULL;
+    unsigned char *data;
+    unsigned size;
 
     if(!filename || !output_sig) {
         goto exit;
     }
 
+    if (md5_map(filename, &data, &size) == 0) {
+        MD5Init(&md5c);
+        MD5Update(&md5c, data, size);
+        MD5Final((unsigned char *) signature, &md5c);
+        if (data)
+            munmap(data, size);
+        md5_signature((unsigned char *) signature, output_sig);
+        return 0;
+    }
+
     in_buff = malloc(MD5_COPY_BUFF);
     if(!in_buff) {
         retval = 1;
@@ -362,12 +580,7 @@ md5_compute(char *filename,
         goto exit;
     }
    
-    // this takes a while when capturing so use line to buffer it
-    output_sig[0] = '\0'; // clear line
-    for (j = 0; j < sizeof(signature); j++) {
-        sprintf(buff, hexfmt, (signature[j] & 0xFF));
-        strcat(output_sig,buff);
-    }
+    md5_signature((unsigned char *) signature, output_sig);
     retval = 0;
 
  exit:
@@ -377,13 +590,226 @@ md5_compute(char *filename,
     return retval;
 }
 
+/// Computes the signature of num_bytes of in_buff
+/// \return 0 on success, 1 on failure
+int
+md5_compute_buffer(char *in_buff,
+                   int num_bytes,
+                   char *output_sig)
+{
+    struct MD5Context md5c;
+    unsigned char signature[16];
+
+    if (!in_buff || !output_sig || num_bytes < 0) {
+        return 1;
+    }
+
+    MD5Init(&md5c);
+    MD5Update(&md5c, (unsigned char *) in_buff, (unsigned) num_bytes);
+    MD5Final(signature, &md5c);
+    md5_signature(signature, output_sig);
+
+    return 0;
+}
+
+/// Computes the signatures of n files together through md5_multi (for
+/// verifying a batch of files at once)
+/// \return 0 on success, 1 if any file could not be read
+int
+md5_compute_files(int n,
+                  char *filenames[],
+                  char (*output_sigs)[MD5_SIG_BUFF])
+{
+    unsigned char **data;
+    unsigned       *size;
+    unsigned char (*digest)[16];
+    int retval = 1;
+    int i;
+
+    data = calloc(n, sizeof(unsigned char *));
+    size = calloc(n, sizeof(unsigned));
+    digest = calloc(n, 16);
+    if (!data || !size || !digest) {
+        goto exit;
+    }
+
+    for (i = 0; i < n; i++) {
+        if (md5_map(filenames[i], &data[i], &size[i]) != 0) {
+            goto exit;
+        }
+    }
+
+    md5_multi(n, data, size, digest);
+
+    for (i = 0; i < n; i++) {
+        md5_signature(digest[i], output_sigs[i]);
+    }
+    retval = 0;
+
+ exit:
+    if (data && size) {
+        for (i = 0; i < n; i++) {
+            if (data[i])
+                munmap(data[i], size[i]);
+        }
+    }
+    free(data);
+    free(size);
+    free(digest);
+    return retval;
+}
+
 #ifdef STANDALONE
+
+/// The transform as it was - every block copied a byte at a time and
+/// byte swapped before MD5Transform - for the benchmark to compare with
+static void
+md5_legacy(unsigned char *buf, unsigned len, unsigned char digest[16])
+{
+    struct MD5Context ctx;
+    uint32 t;
+    int i;
+
+    MD5Init(&ctx);
+    md5_count(&ctx, len & ~63);
+    while (len >= 64) {
+        for (i = 0; i < 64; i++) ctx.in[i] = buf[i];
+        for (i = 0; i < 16; i++) {
+            t = (uint32) ((unsigned) ctx.in[4*i+3] << 8 | ctx.in[4*i+2]) << 16
+                | ((unsigned) ctx.in[4*i+1] << 8 | ctx.in[4*i]);
+            memcpy(ctx.in + 4*i, &t, 4);
+        }
+        MD5Transform(ctx.buf, (uint32 *) ctx.in);
+        buf += 64;
+        len -= 64;
+    }
+    MD5Update(&ctx, buf, len);
+    MD5Final(digest, &ctx);
+}
+
+static double
+now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/// md5 file - prints the file's signature
+/// md5 -b [size] - checks the single stream, multi-buffer and file paths
+/// against each other and RFC 1321's test vectors and reports MB/s
 int
 main(int argc, char *argv[])
 {
+    static char *vectors[][2] = {
+        { "", "d41d8cd98f00b204e9800998ecf8427e" },
+        { "abc", "900150983cd24fb0d6963f7d28e17f72" },
+        { "message digest", "f96b697d7cb7938d525a2f31aaf161d0" },
+        { "12345678901234567890123456789012345678901234567890123456789012345678901234567890",
+          "57edf4a22be3c955ac49da2e2107b67a" },
+    };
     char signature[65];
+    char reference[65];
+    char path[] = "/tmp/md5benchXXXXXX";
+    char (*sigs)[MD5_SIG_BUFF];
+    char *paths[MD5_LANES];
+    unsigned char *data[MD5_LANES];
+    unsigned len[MD5_LANES];
+    unsigned char digest[MD5_LANES][16];
+    unsigned char ref[MD5_LANES][16];
+    unsigned size;
+    double t;
+    int bad = 0;
+    int fd;
+    int i;
+
+    if (argc < 2 || strcmp(argv[1], "-b")) {
+        if (argc < 2 || md5_compute(argv[1], signature))
+            return 1;
+        printf("%s\n", signature);
+        return 0;
+    }
+
+    size = argc > 2 ? strtoul(argv[2], NULL, 0) : 16 << 20;
+
+    for (i = 0; i < (int) (sizeof(vectors) / sizeof(vectors[0])); i++) {
+        md5_compute_buffer(vectors[i][0], strlen(vectors[i][0]), signature);
+        if (strcmp(signature, vectors[i][1])) {
+            printf("\"%s\": %s, expected %s\n", vectors[i][0], signature, vectors[i][1]);
+            bad = 1;
+        }
+    }
+
+    // lanes of different lengths, so the common blocks run out at
+    // different points and every lane gets a scalar tail
+    srandom(1);
+    for (i = 0; i < MD5_LANES; i++) {
+        len[i] = size - i * 4099;
+        if ((data[i] = malloc(len[i])) == NULL)
+            return 1;
+        for (unsigned j = 0; j < len[i]; j++)
+            data[i][j] = random();
+    }
+
+    t = now();
+    for (i = 0; i < MD5_LANES; i++)
+        md5_legacy(data[i], len[i], ref[i]);
+    t = now() - t;
+    printf("legacy     %8.1f MB/s\n", size * (double) MD5_LANES / t / 1e6);
+
+    t = now();
+    for (i = 0; i < MD5_LANES; i++)
+        md5_compute_buffer((char *) data[i], len[i], signature);
+    t = now() - t;
+    printf("single     %8.1f MB/s\n", size * (double) MD5_LANES / t / 1e6);
+    md5_signature(ref[MD5_LANES - 1], reference);
+    if (strcmp(signature, reference)) {
+        printf("single: %s, expected %s\n", signature, reference);
+        bad = 1;
+    }
+
+    t = now();
+    md5_multi(MD5_LANES, data, len, digest);
+    t = now() - t;
+    printf("multi x%d   %8.1f MB/s\n", MD5_LANES, size * (double) MD5_LANES / t / 1e6);
+
+    // files, both one at a time and as a batch
+    sigs = calloc(MD5_LANES, MD5_SIG_BUFF);
+    for (i = 0; i < MD5_LANES; i++) {
+        if (memcmp(digest[i], ref[i], 16)) {
+            printf("multi: lane %d differs\n", i);
+            bad = 1;
+        }
+        strcpy(path, "/tmp/md5benchXXXXXX");
+        if ((fd = mkstemp(path)) < 0 || write(fd, data[i], len[i]) != len[i])
+            return 1;
+        close(fd);
+        paths[i] = strdup(path);
+    }
+
+    t = now();
+    for (i = 0; i < MD5_LANES; i++)
+        md5_compute(paths[i], signature);
+    t = now() - t;
+    printf("file       %8.1f MB/s\n", size * (double) MD5_LANES / t / 1e6);
+
+    t = now();
+    md5_compute_files(MD5_LANES, paths, sigs);
+    t = now() - t;
+    printf("files x%d   %8.1f MB/s\n", MD5_LANES, size * (double) MD5_LANES / t / 1e6);
+
+    for (i = 0; i < MD5_LANES; i++) {
+        md5_signature(ref[i], reference);
+        md5_compute(paths[i], signature);
+        if (strcmp(signature, reference) || strcmp(sigs[i], reference)) {
+            printf("%s: %s %s, expected %s\n", paths[i], signature, sigs[i], reference);
+            bad = 1;
+        }
+        unlink(paths[i]);
+    }
 
-    md5_compute(argv[1], signature);
-    printf("%s\n", signature);
+    printf("%s\n", bad ? "FAILED" : "all paths agree");
+    return bad;
 }
 #endif
@@ -17,6 +17,7 @@
 
 #define MD5_COPY_BUFF 4096    ///< Buffer size for MD5 to use when copying
 #define MD5_SIG_BUFF 34       ///< Buffer size for MD5 signatures
+#define MD5_LANES 8           ///< Streams md5_multi hashes side by side
 
 #ifdef __alpha
 typedef unsigned int uint32;
@@ -36,9 +37,12 @@ extern void MD5Final(unsigned char digest[16], struct MD5Context *);
 extern void MD5Transform(uint32 buf[4], uint32 in[16]);
 void byteReverse(unsigned char *, uint32);
 
+void md5_signature(unsigned char digest[16], char *output_sig);
 int md5_compare(char *,char *);
 int md5_compute(char *, char *);
 int md5_compute_buffer(char *in_buff, int num_bytes, char *output_sig);
+int md5_compute_files(int n, char *filenames[], char (*output_sigs)[MD5_SIG_BUFF]);
+void md5_multi(int n, unsigned char *data[], unsigned len[], unsigned char digest[][16]);
 
 
 /*
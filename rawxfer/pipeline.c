@@ -0,0 +1,318 @@
+// Copyright (c) 2023  University of Washington.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the University of Washington nor the names of its
+//    contributors may be used to endorse or promote products derived from this
+//    software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY OF WASHINGTON AND CONTRIBUTORS “AS
+// IS” AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE UNIVERSITY OF WASHINGTON OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+// GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+// OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/// @file pipeline.c
+///
+/// Windowed rawrcvb (rawrcvb -w N).  The main thread keeps pulling
+/// headers and bodies off the line, streaming each body to its temporary
+/// (see commit.c) and digesting it as it arrives, as rawrcvb does, into a
+/// queue of at most N files.  A writer thread syncs and commits each one
+/// and sends the verdicts - in the order the files arrived.  The sender
+/// may therefore have up to N files outstanding, so sync time and the
+/// wait for each verdict are hidden behind link time rather than added
+/// to it, while memory stays bounded whatever sizes the headers claim.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include "md5.h"
+#include "rxbuf.h"
+#include "digest.h"
+#include "commit.h"
+#include "inspect.h"
+#include "profile.h"
+#include "rsyslog.h"
+
+extern int  batch_header(unsigned char *header, unsigned int *size, char **fname, char **md5_in);
+
+/// One received file waiting for its verdict
+typedef struct {
+    unsigned char     header[53];
+    char             *fname;
+    char             *md5_in;
+    unsigned int      size;
+    unsigned int      nread;
+    int               out;          ///< its temporary, still open
+    int               werr;
+    struct MD5Context md5c;
+} Entry;
+
+static Entry          **queue;
+static int              qsize;
+static int              qhead;
+static int              qcount;
+static Entry           *current;    ///< the one the writer has in hand
+static pthread_mutex_t  qlock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   qnotfull = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t   qnotempty = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t   qdone = PTHREAD_COND_INITIALIZER;
+
+static int              num_wanted;
+static char           (*received)[16];  ///< names said OK to, this batch
+static int              finished = 0;
+static int              wake[2];
+
+static void
+md5_sink(void *arg, unsigned char *data, unsigned n)
+{
+    MD5Update((struct MD5Context *) arg, data, n);
+}
+
+static void
+enqueue(Entry *e)
+{
+    pthread_mutex_lock(&qlock);
+    while (qcount == qsize)
+        pthread_cond_wait(&qnotfull, &qlock);
+    queue[(qhead + qcount) % qsize] = e;
+    qcount ++;
+    pthread_cond_signal(&qnotempty);
+    pthread_mutex_unlock(&qlock);
+}
+
+static Entry *
+dequeue(void)
+{
+    Entry *e;
+
+    pthread_mutex_lock(&qlock);
+    while (qcount == 0)
+        pthread_cond_wait(&qnotempty, &qlock);
+    e = queue[qhead];
+    qhead = (qhead + 1) % qsize;
+    qcount --;
+    current = e;
+    pthread_cond_signal(&qnotfull);
+    pthread_mutex_unlock(&qlock);
+
+    return e;
+}
+
+/// The writer is through with e
+static void
+release(Entry *e)
+{
+    pthread_mutex_lock(&qlock);
+    current = NULL;
+    pthread_cond_signal(&qdone);
+    pthread_mutex_unlock(&qlock);
+    free(e);
+}
+
+/// \return 1 if a file named fname is queued or in the writer's hands
+static int
+pending(char *fname)
+{
+    int j;
+
+    if (current && strcmp(current->fname, fname) == 0)
+        return 1;
+    for (j = 0 ; j < qcount ; j++) {
+        if (strcmp(queue[(qhead + j) % qsize]->fname, fname) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+/// Waits until the writer has finished with any earlier copy of fname -
+/// a resend shares its temporary
+static void
+wait_clear(char *fname)
+{
+    pthread_mutex_lock(&qlock);
+    while (pending(fname))
+        pthread_cond_wait(&qdone, &qlock);
+    pthread_mutex_unlock(&qlock);
+}
+
+/// Writer thread - verify, commit and answer for each file in turn
+static void *
+writer(void *arg)
+{
+    Entry            *e;
+    unsigned char     digest[16];
+    char              md5_out[65];
+    int               match = 0;
+    char             *verdict;
+    int               werr;
+    int               i = 0;
+    int               j;
+
+    (void) arg;
+
+    while ((e = dequeue())) {
+        werr = e->werr;
+        if (e->size != e->nread) {
+            verdict = "E0";
+        }
+        else {
+            MD5Final(digest, &e->md5c);
+            match = digest_verify(e->md5_in, digest);
+            verdict = (werr || !match) ? "E2" : "OK";
+        }
+
+        // Only a verified file appears under its real name
+        if (verdict[0] == 'O') {
+            if ((werr = cm_commit(e->fname, e->out)))
+                verdict = "E2";
+        }
+        else {
+            cm_abandon(e->fname, e->out, 0);
+        }
+
+        printf("%s", verdict);
+        fflush(stdout);
+
+        if (verdict[0] == 'O')
+            ins_file(e->fname);
+
+        if (e->size != e->nread) {
+            rsyslog(0, "E0 %u %u %s", e->size, e->nread, e->fname);
+        }
+        else if (werr) {
+            rsyslog(0, "E2 write to %s failed (%s)", e->fname, strerror(werr));
+        }
+        else if (!match) {
+            md5_signature(digest, md5_out);
+            rsyslog(0, "E2 %s %s %s", e->md5_in, md5_out, e->fname);
+        }
+        else {
+            rsyslog(0, "OK %s", e->fname);
+            // as in batch() - a resend of a file we already said OK
+            // to does not count again.  With a window the resend can
+            // land after later files, so every name is remembered.
+            for (j = 0 ; j < i && strcmp(received[j], e->fname) ; j++)
+                ;
+            if (j == i && i < num_wanted) {
+                strncpy(received[i], e->fname, sizeof(received[i]) - 1);
+                i ++;
+            }
+
+            if (i == num_wanted) {
+                pthread_mutex_lock(&qlock);
+                finished = 1;
+                pthread_mutex_unlock(&qlock);
+                write(wake[1], "", 1);
+            }
+        }
+
+        release(e);
+    }
+
+    return NULL;
+}
+
+/// Receives num_to_receive files with up to window of them queued
+/// ahead of the writer
+/// \return 0 if all the files arrived, 1 otherwise
+int
+pipeline(int num_to_receive, int window)
+{
+    pthread_t       tid;
+    Entry          *e;
+    struct timeval  start, stop;
+    double          secs;
+    int             done;
+
+    num_wanted = num_to_receive;
+    qsize = window;
+    if ((queue = calloc(qsize, sizeof(Entry *))) == NULL
+        || (received = calloc(num_wanted, sizeof(received[0]))) == NULL
+        || pipe(wake) != 0) {
+        rsyslog(0, "could not set up %d file window", window);
+        return 1;
+    }
+
+    // once the writer has all the files it needs it pokes the
+    // receive side out of its wait for another header
+    rx_abort_on(wake[0]);
+
+    if (pthread_create(&tid, NULL, writer, NULL) != 0) {
+        rsyslog(0, "could not start writer");
+        return 1;
+    }
+
+    rsyslog(0, "receiving with a %d file window", window);
+
+    for (;;) {
+        if ((e = calloc(1, sizeof(Entry))) == NULL)
+            break;
+        e->out = -1;
+
+        if (rx_exact(0, e->header, 52) != 52) {
+            pthread_mutex_lock(&qlock);
+            done = finished;
+            pthread_mutex_unlock(&qlock);
+            if (!done)
+                rsyslog(0, "did not receive 52 header bytes");
+            free(e);
+            break;
+        }
+
+        if (batch_header(e->header, &e->size, &e->fname, &e->md5_in)) {
+            rsyslog(0, "bad filename");
+            free(e);
+            break;
+        }
+        rsyslog(0, "Receiving %u bytes of %s", e->size, e->fname);
+
+        wait_clear(e->fname);
+        e->out = cm_open(e->fname, e->size);
+        MD5Init(&e->md5c);
+
+        gettimeofday(&start, NULL);
+        pf_begin(e->fname, e->size, 0);
+        // a temporary that would not open shows up as a write error,
+        // failing just this file
+        e->nread = rx_body(0, e->out, e->size, md5_sink, &e->md5c, &e->werr);
+        // the verdict comes later, from the writer
+        pf_end(e->nread, NULL);
+        gettimeofday(&stop, NULL);
+
+        secs = (stop.tv_sec - start.tv_sec) + (stop.tv_usec - start.tv_usec)/1e6;
+        rsyslog(0, "Received %u bytes of %s (%.1f Bps)", e->nread, e->fname, e->nread/secs);
+
+        // a short file means the line is gone - let the writer
+        // report it and stop
+        done = e->nread != e->size;
+
+        enqueue(e);
+
+        if (done)
+            break;
+    }
+
+    enqueue(NULL);
+    pthread_join(tid, NULL);
+
+    return finished ? 0 : 1;
+}
@@ -0,0 +1,209 @@
+// Copyright (c) 2023  University of Washington.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the University of Washington nor the names of its
+//    contributors may be used to endorse or promote products derived from this
+//    software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY OF WASHINGTON AND CONTRIBUTORS “AS
+// IS” AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE UNIVERSITY OF WASHINGTON OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+// GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+// OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/// @file profile.c
+///
+/// With RAWRCV_PROFILE naming a file, rawrcv/rawrcvb append one JSON
+/// record per file received to it, e.g.
+///
+///     {"file":"sg0001dz.x00","size":4096,"received":4096,"offset":0,
+///      "verdict":"OK","start":1697420000.123,"elapsed_us":1843000,
+///      "select_us":1790000,"write_us":210,"hash_us":95,"reads":40,
+///      "near_timeouts":0,"max_gap_us":410000,
+///      "gap_hist":[3,0,0,0,1,...],"bps":[2230,2260,...]}
+///
+/// select_us is time spent waiting on the line, write_us and hash_us
+/// the time spent on the disk and the digest - so a slow file can be
+/// put down to the modem, the disk or the CPU.  gap_hist counts the
+/// gaps between successive reads that brought data, binned as <1 ms,
+/// 1-2 ms, 2-4 ms and so on; near_timeouts counts waits longer than half
+/// of RX_TIMEOUT.  bps is the bytes that arrived in each second of the
+/// transfer.  CommLog.py's load_rawrcv_profile reads the records back.
+///
+/// When RAWRCV_PROFILE is not set none of this is timed.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "rxbuf.h"
+#include "profile.h"
+
+int pf_active = 0;
+
+static int       enabled = -1;
+static char     *fname;
+static unsigned  size;
+static unsigned  offset;
+static double    start;         ///< wall clock, for the record
+static long      t0;            ///< monotonic, for everything else
+static long      last_read;
+static long      select_us;
+static long      write_us;
+static long      sink_us;
+static long      max_gap;
+static unsigned  reads;
+static unsigned  near;
+static unsigned  gaps[PF_GAP_BINS];
+static unsigned *bps = NULL;
+static unsigned  nbps = 0;      ///< seconds covered by bps
+static unsigned  abps = 0;      ///< seconds allocated
+
+/// Monotonic microseconds
+long
+pf_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+/// Starts profiling the receipt of fname (size bytes, offset of which
+/// are already on hand)
+void
+pf_begin(char *name, unsigned sz, unsigned off)
+{
+    struct timespec ts;
+
+    if (enabled < 0)
+        enabled = getenv(PF_ENV) != NULL;
+    if (!enabled)
+        return;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    start = ts.tv_sec + ts.tv_nsec / 1e9;
+    t0 = last_read = pf_now();
+
+    fname = name;
+    size = sz;
+    offset = off;
+    select_us = write_us = sink_us = max_gap = 0;
+    reads = near = nbps = 0;
+    memset(gaps, 0, sizeof(gaps));
+    pf_active = 1;
+}
+
+/// A select() that took us
+void
+pf_wait(long us)
+{
+    select_us += us;
+    if (us > PF_NEAR * 1000000L)
+        near ++;
+}
+
+/// n bytes just arrived
+void
+pf_read(unsigned n)
+{
+    long     now = pf_now();
+    long     gap = now - last_read;
+    unsigned sec = (now - t0) / 1000000L;
+    unsigned *grown;
+    int      bin;
+
+    // the first gap is the wait for the sender to start, not a stall
+    if (reads++) {
+        for (bin = 0 ; bin < PF_GAP_BINS - 1 && gap >= (1000L << bin) ; bin++)
+            ;
+        gaps[bin] ++;
+        if (gap > max_gap)
+            max_gap = gap;
+    }
+    last_read = now;
+
+    if (sec >= abps) {
+        if ((grown = realloc(bps, (sec + 64) * sizeof(unsigned))) == NULL)
+            return;
+        bps = grown;
+        abps = sec + 64;
+    }
+    while (nbps <= sec)
+        bps[nbps++] = 0;
+    bps[sec] += n;
+}
+
+/// A write to disk that took us
+void
+pf_write(long us)
+{
+    write_us += us;
+}
+
+/// A pass through the sink (the digest) that took us
+void
+pf_sink(long us)
+{
+    sink_us += us;
+}
+
+/// Finishes the file and appends its record
+void
+pf_end(unsigned nread, char *verdict)
+{
+    char    *rec;
+    size_t   len;
+    FILE    *fp;
+    int      fd;
+    unsigned i;
+
+    if (!pf_active)
+        return;
+    pf_active = 0;
+
+    // built in memory and written in one go so records from
+    // concurrent receivers don't interleave
+    if ((fp = open_memstream(&rec, &len)) == NULL)
+        return;
+
+    fprintf(fp, "{\"file\":\"%s\",\"size\":%u,\"received\":%u,\"offset\":%u,",
+            fname, size, nread, offset);
+    if (verdict)
+        fprintf(fp, "\"verdict\":\"%s\",", verdict);
+    else
+        fprintf(fp, "\"verdict\":null,");
+    fprintf(fp, "\"start\":%.3f,\"elapsed_us\":%ld,\"select_us\":%ld,"
+            "\"write_us\":%ld,\"hash_us\":%ld,\"reads\":%u,\"near_timeouts\":%u,"
+            "\"max_gap_us\":%ld,\"gap_hist\":[",
+            start, pf_now() - t0, select_us, write_us, sink_us, reads, near, max_gap);
+    for (i = 0 ; i < PF_GAP_BINS ; i++)
+        fprintf(fp, i ? ",%u" : "%u", gaps[i]);
+    fprintf(fp, "],\"bps\":[");
+    for (i = 0 ; i < nbps ; i++)
+        fprintf(fp, i ? ",%u" : "%u", bps[i]);
+    fprintf(fp, "]}\n");
+    fclose(fp);
+
+    if ((fd = open(getenv(PF_ENV), O_WRONLY | O_APPEND | O_CREAT, 0666)) >= 0) {
+        write(fd, rec, len);
+        close(fd);
+    }
+    free(rec);
+}
@@ -0,0 +1,49 @@
+// Copyright (c) 2023  University of Washington.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the University of Washington nor the names of its
+//    contributors may be used to endorse or promote products derived from this
+//    software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY OF WASHINGTON AND CONTRIBUTORS “AS
+// IS” AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE UNIVERSITY OF WASHINGTON OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+// GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+// OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/// @file profile.h
+///
+/// Per-file link profile for rawrcv/rawrcvb
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#define PF_ENV        "RAWRCV_PROFILE"  ///< File to append the records to
+#define PF_GAP_BINS   17      ///< Inter-read gap bins: <1 ms, then doubling to 32 s+
+#define PF_NEAR       (RX_TIMEOUT / 2)  ///< Waits longer than this (s) are near-timeouts
+
+extern int pf_active;         ///< A file is being profiled
+
+long pf_now(void);
+void pf_begin(char *fname, unsigned size, unsigned offset);
+void pf_wait(long us);
+void pf_read(unsigned n);
+void pf_write(long us);
+void pf_sink(long us);
+void pf_end(unsigned nread, char *verdict);
+
+#endif /* !PROFILE_H */
@@ -0,0 +1,812 @@
+// Copyright (c) 2023  University of Washington.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the University of Washington nor the names of its
+//    contributors may be used to endorse or promote products derived from this
+//    software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY OF WASHINGTON AND CONTRIBUTORS “AS
+// IS” AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE UNIVERSITY OF WASHINGTON OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+// GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+// OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/// @file rawbench.c
+///
+/// Transfer simulator and benchmark for the raw receive path.  Plays the
+/// part of the glider - or relays for rawsend/rawsendb - over a
+/// pseudo-terminal pair into rawrcv/rawrcvb, through a link that can be
+/// slowed, delayed, made to lose or corrupt bytes and cut part way.
+/// Reports throughput, the receiver's (and sender's) CPU time and
+/// read/write system calls per MB, the verdicts that came back and
+/// whether every file arrived intact.
+///
+///     rawbench [-b] [-w window] [-r] [-n files] [-s size] [-t retries]
+///              [-B bytes/s] [-l ms] [-D n] [-C n] [-x bytes]
+///              [-S /path/to/rawsend] [-k] /path/to/rawrcv2
+///
+/// -b/-w    run the receiver as rawrcvb (-w N keeps N files in flight)
+/// -r       run the receiver with -r and pick up where it says to
+/// -t       times to resend a file that draws E0/E2 (default 3)
+/// -B       link speed in bytes/s (default unlimited)
+/// -l       one way latency in ms, paid once each way per file
+/// -D/-C    drop/corrupt every nth byte of file bodies (each drop costs
+///          the receiver an RX_TIMEOUT; runs repeat exactly)
+/// -x       cut the link after this many bytes, then redial
+/// -S       have rawsend (rawsendb with -b) do the sending; rawbench
+///          just carries the bytes, verdicts and impairments
+/// -k       keep the scratch directory
+///
+/// Exits non-zero unless every file arrived intact.  `make bench` runs a
+/// set of scenarios; run it against a build of the previous receiver to
+/// compare.
+
+#define _GNU_SOURCE // for posix_openpt et al
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <termios.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <sys/select.h>
+#include "md5.h"
+
+#define LINK_CHUNK 256        ///< Bytes per paced write onto the link
+#define REPLY_SECS 30         ///< Longest wait for a verdict (> RX_TIMEOUT)
+
+typedef struct {
+    long bandwidth;           ///< bytes/s, 0 for unlimited
+    long latency;             ///< ms
+    long drop;                ///< lose every drop'th body byte
+    long corrupt;             ///< flip every corrupt'th body byte
+    long cut_at;              ///< cut after this many bytes, -1 never
+} Link;
+
+/// Totals over every process run
+typedef struct {
+    double        user, sys;
+    unsigned long rd, wr;
+} Usage;
+
+static Link          wire = { 0, 0, 0, 0, -1 };
+static long          pushed = 0;
+static double        link_free = 0;
+static int           cut = 0;
+static unsigned long body = 0;       // file body bytes put on the link
+static long          cut_was = -1;  // where the link was cut
+static unsigned long resumed = 0;   // bytes the receiver already held
+static unsigned long ndropped = 0, ncorrupted = 0;
+static Usage         rcv_use, snd_use;
+static int           verdicts[4];    // OK, E0, E2, no reply
+static char         *receiver;
+
+static int
+usage(void)
+{
+    fprintf(stderr, "rawbench [-b] [-w window] [-r] [-n files] [-s size] [-t retries]\n"
+                    "         [-B bytes/s] [-l ms] [-D n] [-C n] [-x bytes]\n"
+                    "         [-S rawsend] [-k] receiver\n");
+    return 1;
+}
+
+static double
+now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void
+sleep_until(double t)
+{
+    double d = t - now();
+
+    if (d > 0)
+        usleep(d * 1e6);
+}
+
+/// Waits up to secs for the other end to say something
+/// \return number of bytes read into buff (NUL terminated)
+static int
+expect(int fd, char *buff, int n, int secs)
+{
+    struct timeval timeout;
+    fd_set         fds;
+    int            got = 0;
+    int            r;
+
+    while (got < n) {
+        timeout.tv_sec = secs;
+        timeout.tv_usec = 0;
+        FD_ZERO(&fds);
+        FD_SET(fd, &fds);
+        if (select(fd + 1, &fds, NULL, NULL, &timeout) <= 0)
+            break;
+        if ((r = read(fd, buff + got, n - got)) <= 0)
+            break;
+        got += r;
+    }
+    buff[got] = 0;
+    return got;
+}
+
+/// Reads up to and including the next '!' (READY!, @offset!)
+static int
+expect_bang(int fd, char *buff, int n, int secs)
+{
+    int got = 0;
+
+    while (got < n - 1 && expect(fd, buff + got, 1, secs) == 1)
+        if (buff[got++] == '!')
+            break;
+    buff[got] = 0;
+    return got;
+}
+
+static int
+push(int fd, unsigned char *data, unsigned n)
+{
+    ssize_t put;
+
+    while (n) {
+        if ((put = write(fd, data, n)) < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        data += put;
+        n -= put;
+    }
+    return 0;
+}
+
+/// Puts n bytes on the link - paced to the link speed, losing or
+/// corrupting bytes if impair is set (file bodies; headers are left
+/// alone so the framing survives), and stopping short if the link is
+/// due to be cut
+/// \return 0, or -1 if the link is (now) cut
+static int
+link_send(int fd, unsigned char *data, unsigned n, int impair)
+{
+    unsigned char chunk[LINK_CHUNK];
+    unsigned      i, k, m;
+
+    while (n && !cut) {
+        m = n < LINK_CHUNK ? n : LINK_CHUNK;
+        if (wire.cut_at >= 0 && pushed + m >= wire.cut_at) {
+            m = wire.cut_at - pushed;
+            cut = 1;
+        }
+        for (i = k = 0 ; i < m ; i++) {
+            if (impair)
+                body ++;
+            if (impair && wire.drop && body % wire.drop == 0) {
+                ndropped ++;
+                continue;
+            }
+            chunk[k] = data[i];
+            if (impair && wire.corrupt && body % wire.corrupt == 0) {
+                chunk[k] ^= 0x55;
+                ncorrupted ++;
+            }
+            k ++;
+        }
+        if (wire.bandwidth) {
+            if (link_free < now())
+                link_free = now();
+            link_free += (double) m / wire.bandwidth;
+            sleep_until(link_free);
+        }
+        if (push(fd, chunk, k))
+            return -1;
+        pushed += m;
+        data += m;
+        n -= m;
+    }
+    return cut ? -1 : 0;
+}
+
+/// One way trip across the link
+static void
+link_delay(void)
+{
+    if (wire.latency)
+        usleep(wire.latency * 1000);
+}
+
+/// Pulls the read/write syscall counts for a dead, but not yet
+/// reaped, child out of /proc
+static void
+syscalls(pid_t pid, unsigned long *rd, unsigned long *wr)
+{
+    char  path[64];
+    char  line[128];
+    FILE *fp;
+
+    *rd = *wr = 0;
+    snprintf(path, sizeof(path), "/proc/%d/io", (int) pid);
+    if ((fp = fopen(path, "r")) == NULL)
+        return;
+    while (fgets(line, sizeof(line), fp)) {
+        sscanf(line, "syscr: %lu", rd);
+        sscanf(line, "syscw: %lu", wr);
+    }
+    fclose(fp);
+}
+
+/// Starts path as argv[0] with stdin and stdout on a new pty
+/// \return the child, with *master the other end of its pty
+static pid_t
+spawn(char *path, char **argv, int *master)
+{
+    struct termios tios;
+    pid_t          pid;
+    int            slave;
+
+    if ((*master = posix_openpt(O_RDWR | O_NOCTTY)) < 0
+        || grantpt(*master) || unlockpt(*master)
+        || (slave = open(ptsname(*master), O_RDWR | O_NOCTTY)) < 0) {
+        perror("pty");
+        exit(1);
+    }
+    fcntl(*master, F_SETFD, FD_CLOEXEC); // or the next child holds the line up
+    tcgetattr(slave, &tios);
+    cfmakeraw(&tios);
+    tcsetattr(slave, TCSANOW, &tios);
+
+    if ((pid = fork()) == 0) {
+        setsid();
+        dup2(slave, 0);
+        dup2(slave, 1);
+        close(*master);
+        close(slave);
+        execv(path, argv);
+        _exit(127);
+    }
+    close(slave);
+    return pid;
+}
+
+/// Waits for a child and adds its CPU time and syscalls to use
+static void
+reap(pid_t pid, Usage *use)
+{
+    siginfo_t     info;
+    struct rusage ru;
+    unsigned long rd, wr;
+    int           status;
+
+    waitid(P_PID, pid, &info, WEXITED | WNOWAIT);
+    syscalls(pid, &rd, &wr);
+    wait4(pid, &status, 0, &ru);
+
+    use->user += ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6;
+    use->sys += ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+    use->rd += rd;
+    use->wr += wr;
+}
+
+/// Ends a receiver - hanging up on it first if it is still waiting
+static void
+hangup(pid_t pid, int master)
+{
+    struct timeval t0;
+    siginfo_t      info;
+
+    close(master);
+    gettimeofday(&t0, NULL);
+    for (;;) {
+        memset(&info, 0, sizeof(info));
+        if (waitid(P_PID, pid, &info, WEXITED | WNOHANG | WNOWAIT) == 0 && info.si_pid)
+            break;
+        if (now() - (t0.tv_sec + t0.tv_usec / 1e6) > 2 * REPLY_SECS) {
+            kill(pid, SIGKILL);
+            break;
+        }
+        usleep(10000);
+    }
+    reap(pid, &rcv_use);
+}
+
+static void
+tally(char *reply)
+{
+    if (strcmp(reply, "OK") == 0)
+        verdicts[0] ++;
+    else if (strcmp(reply, "E0") == 0)
+        verdicts[1] ++;
+    else if (strcmp(reply, "E2") == 0)
+        verdicts[2] ++;
+    else
+        verdicts[3] ++;
+}
+
+/// Starts the receiver for the files still wanted
+/// \return pid, with the offset it reports in *offset (single, -r)
+static pid_t
+start_receiver(int batch, int window, int resume, int nwanted, char *fname,
+               unsigned size, char *sig, int *master, unsigned *offset)
+{
+    char  arg_n[16], arg_size[16], arg_w[16];
+    char  reply[64];
+    char *argv[8];
+    int   n = 0;
+    pid_t pid;
+
+    argv[n++] = batch ? "rawrcvb" : "rawrcv";
+    if (resume)
+        argv[n++] = "-r";
+    if (window > 1) {
+        snprintf(arg_w, sizeof(arg_w), "%d", window);
+        argv[n++] = "-w";
+        argv[n++] = arg_w;
+    }
+    if (batch) {
+        snprintf(arg_n, sizeof(arg_n), "%d", nwanted);
+        argv[n++] = arg_n;
+    }
+    else {
+        snprintf(arg_size, sizeof(arg_size), "%u", size);
+        argv[n++] = fname;
+        argv[n++] = arg_size;
+        argv[n++] = sig;
+    }
+    argv[n] = NULL;
+
+    pid = spawn(receiver, argv, master);
+
+    *offset = 0;
+    if (expect(*master, reply, 6, 5) != 6 || strcmp(reply, "READY!")) {
+        fprintf(stderr, "receiver did not come ready (%s)\n", reply);
+        kill(pid, SIGKILL);
+        exit(1);
+    }
+    if (resume && !batch && expect_bang(*master, reply, sizeof(reply), 5) > 0)
+        sscanf(reply, "@%u!", offset);
+
+    return pid;
+}
+
+/// rawbench as the glider
+static void
+generate(int batch, int window, int resume, int retries, int nfiles, unsigned size,
+         unsigned char **data, char (*names)[16], char (*sigs)[MD5_SIG_BUFF])
+{
+    unsigned char header[52];
+    char          reply[64];
+    int          *queue;            // files to send, in order
+    int          *attempts;
+    int           head = 0, tail = 0;
+    int           inflight[64];
+    int           nin = 0;
+    int           ok = 0;
+    int          *done;
+    int           master;
+    unsigned      offset;
+    pid_t         pid;
+    int           f, i;
+
+    queue = calloc(nfiles * (retries + 2) + 1, sizeof(int));
+    attempts = calloc(nfiles, sizeof(int));
+    done = calloc(nfiles, sizeof(int));
+    for (i = 0 ; i < nfiles ; i++)
+        queue[tail++] = i;
+    if (window > 64)
+        window = 64;
+
+    pid = -1;
+    while (head < tail || nin) {
+        if (pid < 0)
+            pid = start_receiver(batch, window, resume, nfiles - ok, names[queue[head]],
+                                 size, sigs[queue[head]], &master, &offset);
+
+        // keep the window full
+        while (head < tail && nin < window && !cut) {
+            f = queue[head++];
+            attempts[f] ++;
+            link_delay();
+            header[0] = size >> 24;
+            header[1] = size >> 16;
+            header[2] = size >> 8;
+            header[3] = size;
+            if (batch) {
+                memset(header + 4, 0, 48);
+                memcpy(&header[4], names[f], strlen(names[f]));
+                memcpy(&header[20], sigs[f], 32);
+                if (link_send(master, header, 52, 0) == 0 && resume) {
+                    offset = 0;
+                    if (expect_bang(master, reply, sizeof(reply), REPLY_SECS) > 0)
+                        sscanf(reply, "@%u!", &offset);
+                }
+            }
+            else {
+                link_send(master, header, 4, 0);
+            }
+            if (offset > size)
+                offset = size;
+            resumed += offset;
+            link_send(master, data[f] + offset, size - offset, 1);
+            offset = 0;
+            inflight[nin++] = f;
+        }
+
+        if (cut) {
+            // dropped call - everything in flight goes again after
+            // the redial (the cut only happens once)
+            hangup(pid, master);
+            pid = -1;
+            for (i = nin - 1 ; i >= 0 ; i--)
+                queue[--head] = inflight[i];
+            nin = 0;
+            cut_was = wire.cut_at;
+            wire.cut_at = -1;
+            cut = 0;
+            continue;
+        }
+
+        // oldest verdict
+        f = inflight[0];
+        memmove(inflight, inflight + 1, --nin * sizeof(int));
+        expect(master, reply, 2, REPLY_SECS);
+        link_delay();
+        tally(reply);
+        if (strlen(reply) < 2) {
+            // receiver gone quiet - hang up and redial as the glider would
+            hangup(pid, master);
+            pid = -1;
+            for (i = nin - 1 ; i >= 0 ; i--)
+                queue[--head] = inflight[i];
+            nin = 0;
+            if (attempts[f] <= retries)
+                queue[--head] = f;
+            continue;
+        }
+        if (strcmp(reply, "OK") == 0) {
+            if (!done[f]) {
+                done[f] = 1;
+                ok ++;
+            }
+        }
+        else if (attempts[f] <= retries) {
+            queue[tail++] = f;
+        }
+
+        // rawrcv takes one file per run
+        if (!batch || (head == tail && nin == 0)) {
+            hangup(pid, master);
+            pid = -1;
+        }
+    }
+
+    free(queue);
+    free(attempts);
+    free(done);
+}
+
+/// rawsend/rawsendb as the glider, rawbench carrying the bytes.  A cut
+/// link is redialled once; with -r the receiver says how much it kept
+/// and rawsend is told to start from there (-o).
+static void
+relay(char *sender, int batch, int resume, int retries, int nfiles, unsigned size,
+      char (*names)[16], char (*sigs)[MD5_SIG_BUFF])
+{
+    unsigned char buff[4096];
+    unsigned char hdr[52];
+    char          reply[64];
+    char          arg_t[16], arg_o[16];
+    char        **argv;
+    char        (*paths)[32];
+    int           hdr_len = batch ? 52 : 4;
+    int           hdr_got;
+    unsigned      body_left;
+    unsigned      t;
+    unsigned      offset;
+    int           vgot;
+    char          vbuf[3];
+    int           rcv, snd;
+    int           snd_open, rcv_open;
+    pid_t         rpid, spid;
+    fd_set        fds;
+    struct timeval timeout;
+    int           n, i;
+
+    argv = calloc(nfiles + 7, sizeof(char *));
+    paths = calloc(nfiles, sizeof(*paths));
+
+    for (;;) {
+        rpid = start_receiver(batch, 1, resume, nfiles, names[0], size, sigs[0],
+                              &rcv, &offset);
+        resumed += offset;
+
+        n = 0;
+        argv[n++] = batch ? "rawsendb" : "rawsend";
+        if (batch) {
+            snprintf(arg_t, sizeof(arg_t), "%d", retries);
+            argv[n++] = "-n";
+            argv[n++] = arg_t;
+        }
+        if (offset) {
+            snprintf(arg_o, sizeof(arg_o), "%u", offset);
+            argv[n++] = "-o";
+            argv[n++] = arg_o;
+        }
+        for (i = 0 ; i < (batch ? nfiles : 1) ; i++) {
+            snprintf(paths[i], sizeof(paths[i]), "src/%s", names[i]);
+            argv[n++] = paths[i];
+        }
+        argv[n] = NULL;
+
+        spid = spawn(sender, argv, &snd);
+        if (expect(snd, reply, 6, 10) != 6 || strcmp(reply, "READY!")) {
+            fprintf(stderr, "sender did not come ready (%s)\n", reply);
+            kill(spid, SIGKILL);
+            exit(1);
+        }
+        link_delay();
+
+        hdr_got = 0;
+        body_left = 0;
+        vgot = 0;
+        snd_open = rcv_open = 1;
+        while (rcv_open && !cut) {
+            FD_ZERO(&fds);
+            FD_SET(rcv, &fds);
+            if (snd_open)
+                FD_SET(snd, &fds);
+            timeout.tv_sec = REPLY_SECS;
+            timeout.tv_usec = 0;
+            if (select((rcv > snd ? rcv : snd) + 1, &fds, NULL, NULL, &timeout) <= 0)
+                break;
+
+            if (snd_open && FD_ISSET(snd, &fds)) {
+                if ((n = read(snd, buff, sizeof(buff))) <= 0)
+                    snd_open = 0;
+
+                // carry it over, impairing only the file bodies
+                for (i = 0 ; i < n && !cut ; i += t) {
+                    if (body_left == 0) {
+                        t = n - i < hdr_len - hdr_got ? n - i : hdr_len - hdr_got;
+                        memcpy(hdr + hdr_got, buff + i, t);
+                        link_send(rcv, buff + i, t, 0);
+                        if ((hdr_got += t) == hdr_len) {
+                            body_left = hdr[0] << 24 | hdr[1] << 16 | hdr[2] << 8 | hdr[3];
+                            body_left -= batch ? 0 : offset;
+                            hdr_got = 0;
+                        }
+                    }
+                    else {
+                        t = (unsigned) (n - i) < body_left ? (unsigned) (n - i) : body_left;
+                        link_send(rcv, buff + i, t, 1);
+                        body_left -= t;
+                    }
+                }
+            }
+
+            if (FD_ISSET(rcv, &fds)) {
+                if ((n = read(rcv, buff, sizeof(buff))) <= 0) {
+                    rcv_open = 0;
+                    break;
+                }
+                // verdicts go back to the sender
+                for (i = 0 ; i < n ; i++) {
+                    vbuf[vgot++] = buff[i];
+                    if (vgot == 2) {
+                        vbuf[2] = 0;
+                        tally(vbuf);
+                        vgot = 0;
+                    }
+                }
+                link_delay();
+                if (snd_open)
+                    push(snd, buff, n);
+            }
+        }
+
+        hangup(rpid, rcv);
+        close(snd);
+        kill(spid, SIGHUP);
+        reap(spid, &snd_use);
+
+        if (!cut)
+            break;
+        cut_was = wire.cut_at;
+        wire.cut_at = -1;
+        cut = 0;
+    }
+
+    free(argv);
+    free(paths);
+}
+
+/// Removes the scratch directory (and src/ below it)
+static void
+cleanup(char *dir)
+{
+    char           path[1024];
+    struct dirent *d;
+    DIR           *dp;
+
+    if ((dp = opendir(dir)) == NULL)
+        return;
+    while ((d = readdir(dp))) {
+        if (strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0)
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", dir, d->d_name);
+        if (d->d_type == DT_DIR)
+            cleanup(path);
+        else
+            unlink(path);
+    }
+    closedir(dp);
+    rmdir(dir);
+}
+
+int
+main(int argc, char *argv[])
+{
+    int             batch = 0;
+    int             window = 1;
+    int             resume = 0;
+    int             retries = 3;
+    int             keep = 0;
+    int             nfiles = 1;
+    unsigned int    size = 1048576;
+    char           *sender = NULL;
+    int             opt;
+    int             i, fd;
+    char            dir[] = "/tmp/rawbenchXXXXXX";
+    char            path[64];
+    char            sig[MD5_SIG_BUFF];
+    char          (*names)[16];
+    char          (*sigs)[MD5_SIG_BUFF];
+    unsigned char **data;
+    double          start, secs, mb;
+    int             intact = 0;
+
+    while ((opt = getopt(argc, argv, "bw:rn:s:t:B:l:D:C:x:S:k")) != -1) {
+        switch (opt) {
+        case 'b':
+            batch = 1;
+            break;
+        case 'w':
+            batch = 1;
+            window = atoi(optarg);
+            break;
+        case 'r':
+            resume = 1;
+            break;
+        case 'n':
+            nfiles = atoi(optarg);
+            break;
+        case 's':
+            size = strtoul(optarg, NULL, 0);
+            break;
+        case 't':
+            retries = atoi(optarg);
+            break;
+        case 'B':
+            wire.bandwidth = atol(optarg);
+            break;
+        case 'l':
+            wire.latency = atol(optarg);
+            break;
+        case 'D':
+            wire.drop = atol(optarg);
+            break;
+        case 'C':
+            wire.corrupt = atol(optarg);
+            break;
+        case 'x':
+            wire.cut_at = atol(optarg);
+            break;
+        case 'S':
+            sender = optarg;
+            break;
+        case 'k':
+            keep = 1;
+            break;
+        default:
+            return usage();
+        }
+    }
+
+    if (optind != argc - 1 || nfiles < 1 || window < 1 || (!batch && nfiles != 1)
+        || (resume && window > 1) || (sender && (window > 1 || (resume && batch))))
+        return usage();
+
+    if ((receiver = realpath(argv[optind], NULL)) == NULL) {
+        perror(argv[optind]);
+        return 1;
+    }
+    if (sender && (sender = realpath(sender, NULL)) == NULL) {
+        perror("sender");
+        return 1;
+    }
+
+    if (mkdtemp(dir) == NULL || chdir(dir) != 0 || mkdir("src", 0777) != 0) {
+        perror(dir);
+        return 1;
+    }
+    setenv("HOME", dir, 1); // keep the receiver's comm.log out of ours
+
+    names = calloc(nfiles, sizeof(*names));
+    sigs = calloc(nfiles, sizeof(*sigs));
+    data = calloc(nfiles, sizeof(*data));
+    srandom(1);
+    for (i = 0 ; i < nfiles ; i++) {
+        if ((data[i] = malloc(size ? size : 1)) == NULL)
+            return 1;
+        for (unsigned j = 0 ; j < size ; j++)
+            data[i][j] = random();
+        md5_compute_buffer((char *) data[i], size, sigs[i]);
+        snprintf(names[i], sizeof(names[i]), "bench%04d.x00", i % 10000);
+        if (sender) {
+            snprintf(path, sizeof(path), "src/%s", names[i]);
+            if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0
+                || write(fd, data[i], size) != size)
+                return 1;
+            close(fd);
+        }
+    }
+
+    start = now();
+    if (sender)
+        relay(sender, batch, resume, retries, nfiles, size, names, sigs);
+    else
+        generate(batch, window, resume, retries, nfiles, size, data, names, sigs);
+    secs = now() - start;
+
+    for (i = 0 ; i < nfiles ; i++)
+        if (md5_compute(names[i], sig) == 0 && md5_compare(sig, sigs[i]) == 0)
+            intact ++;
+
+    mb = (double) size * nfiles / 1048576.0;
+
+    for (i = 1 ; i < argc - 1 ; i++)
+        printf("%s ", argv[i]);
+    printf("%s: %d/%d intact, %d OK %d E0 %d E2 %d no reply, %.2f MB in %.3f s, %.0f bytes/s\n",
+           argv[optind], intact, nfiles, verdicts[0], verdicts[1], verdicts[2], verdicts[3],
+           mb, secs, mb * 1048576.0 / secs);
+    printf("    receiver cpu %.3f user %.3f sys, %.0f reads/MB %.0f writes/MB\n",
+           rcv_use.user, rcv_use.sys, rcv_use.rd / mb, rcv_use.wr / mb);
+    if (sender)
+        printf("    sender cpu %.3f user %.3f sys, %.0f reads/MB %.0f writes/MB\n",
+               snd_use.user, snd_use.sys, snd_use.rd / mb, snd_use.wr / mb);
+    if (cut_was >= 0)
+        printf("    link cut at %ld, redialled, %lu bytes resumed\n", cut_was, resumed);
+    else if (cut)
+        printf("    link cut at %ld\n", wire.cut_at);
+    if (ndropped || ncorrupted)
+        printf("    link dropped %lu corrupted %lu bytes\n", ndropped, ncorrupted);
+
+    if (keep)
+        printf("    kept %s\n", dir);
+    else
+        cleanup(dir);
+
+    return intact == nfiles ? 0 : 1;
+}
@@ -30,13 +30,37 @@
 #include <stdlib.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <signal.h>
 #include <termios.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <string.h>
 #include <ctype.h>
 #include "md5.h"
+#include "rxbuf.h"
+#include "resume.h"
+#include "commit.h"
+#include "inspect.h"
+#include "profile.h"
+#include "digest.h"
+#include "rsyslog.h"
+
+extern int  pipeline(int num_to_receive, int window);
+
+static void
+md5_sink(void *arg, unsigned char *data, unsigned n)
+{
+    MD5Update((struct MD5Context *) arg, data, n);
+}
 
-extern void rsyslog(int prio, const char *format, ...);
+/// rawrcvb also tees what it receives to the inspection (a no-op unless
+/// RAWRCV_INSPECT is set)
+static void
+batch_sink(void *arg, unsigned char *data, unsigned n)
+{
+    MD5Update((struct MD5Context *) arg, data, n);
+    ins_feed(data, n);
+}
 
 char *
 strip(char *f)
@@ -56,26 +80,56 @@ strip(char *f)
     return o;
 }
 
+/// Splits a 52 byte rawrcvb header (4 byte big-endian size, 16 byte
+/// name, 32 byte signature) in place.  header must have room for a
+/// 53rd byte.
+/// \return 0 on success, 1 if there is no usable file name
+int
+batch_header(unsigned char *header, unsigned int *size, char **fname, char **md5_in)
+{
+    unsigned char *sizebuf;
+
+    sizebuf = (unsigned char *) size;
+
+    sizebuf[3] = header[0];
+    sizebuf[2] = header[1];
+    sizebuf[1] = header[2];
+    sizebuf[0] = header[3];
+
+    *fname  = (char *) &(header[4]);
+    (*fname)[15] = 0;
+    *md5_in = (char *) &(header[20]);
+    (*md5_in)[32] = 0;
+
+    //if (!isalnum(fname[0])) {
+    //    rsyslog(0, "bad filename %s", fname);
+    //    return 1;
+    //}
+
+    strip(*fname);
+    return (*fname)[0] == 0;
+}
+
 int
-batch(int argc, char *argv[])
+batch(int argc, char *argv[], int resume, int window)
 {
     struct termios tios, orig_tios;
 
-    FILE          *fp;
+    int            out;
     int            num_to_receive;
     unsigned int   nread;
-    struct stat    statbuf;
-    unsigned char *sizebuf;
+    unsigned int   offset;
     unsigned char  header[53];
     unsigned int   size;
     struct timeval start, stop;
-    struct timeval timeout;
     double         secs;
-    int            fd;
-    fd_set         fds;
-    unsigned char  c;
+    int            werr;
     char          *md5_in = NULL;
     char           md5_out[65];
+    int            match = 0;
+    unsigned char  digest[16];
+    struct MD5Context md5c;
+    char          *verdict;
     int            i;
     char          *fname;
     char          *prevName = NULL;
@@ -103,108 +157,103 @@ batch(int argc, char *argv[])
 
     printf("READY!"); fflush(stdout);
 
+    if (window > 1) {
+        i = pipeline(num_to_receive, window);
+        tcsetattr(0, TCSANOW, &orig_tios);
+        return i;
+    }
+
     for (i = 0 ; i < num_to_receive ; ) {
 
-        nread = 0;
-        while(nread < 52) {
-            timeout.tv_sec = 20;
-            timeout.tv_usec = 0;
-            FD_ZERO(&fds);
-            FD_SET(0, &fds);
-        
-            if (select(1, &fds, NULL, NULL, &timeout) > 0) {
-                if (read(0, &c, 1) == 1) {
-                    header[nread ++] = c;
-                }
-                else {
-                    break;
-                }
-            }
-            else {
-                break;
-            }
-        }
+        nread = rx_exact(0, header, 52);
     
         if (nread != 52) {
             rsyslog(0, "did not receive 52 header bytes");
             return 1;
         }
 
-        sizebuf = (unsigned char *) &size;
-
-        sizebuf[3] = header[0];
-        sizebuf[2] = header[1];
-        sizebuf[1] = header[2];
-        sizebuf[0] = header[3];
-
-        fname  = &(header[4]);
-        fname[15] = 0;
-        md5_in = &(header[20]);
-        md5_in[32] = 0;
-
-        //if (!isalnum(fname[0])) {
-        //    rsyslog(0, "bad filename %s", fname);
-        //    return 1;
-        //}
-
-        strip(fname);
-        if (fname[0] == 0) {
+        if (batch_header(header, &size, &fname, &md5_in)) {
             rsyslog(0, "bad filename");
             return 1;
         }
         rsyslog(0, "Receiving %u bytes of %s", size, fname);
 
-        fp = fopen(fname, "wb");
+        offset = 0;
+        if (resume) {
+            // Tell the sender where to pick up - zero when there is
+            // no usable checkpoint
+            out = rs_open(fname, size, md5_in, &md5c, &offset);
+            printf("@%u!", offset); fflush(stdout);
+            if (offset)
+                rsyslog(0, "Resuming %s at %u", fname, offset);
+        }
+        else {
+            out = cm_open(fname, size);
+            MD5Init(&md5c);
+        }
+
+        ins_begin(fname, offset);
+        pf_begin(fname, size, offset);
 
         gettimeofday(&start, NULL);
        
-        nread = 0;
-        while(nread < size) {
-            timeout.tv_sec = 20;
-            timeout.tv_usec = 0;
-            FD_ZERO(&fds);
-            FD_SET(0, &fds);
-
-            if (select(1, &fds, NULL, NULL, &timeout) > 0) {
-                if (read(0, &c, 1) == 1) {
-                    fputc(c, fp);
-                    nread ++;
-                }
-                else {
-                    break;
-                }
-            }
-            else {
-                break;
-            }
+        // The digest is built as the bytes arrive so the verdict can go
+        // back to the glider as soon as the last one lands
+        nread = rx_body(0, out, size - offset, batch_sink, &md5c, &werr);
+
+        gettimeofday(&stop, NULL);
+
+        if (size != offset + nread) {
+            verdict = "E0";
+        }
+        else {
+            MD5Final(digest, &md5c);
+            match = digest_verify(md5_in, digest);
+            verdict = (werr || !match) ? "E2" : "OK";
         }
 
-        fflush(fp);
+        // Only a verified file appears under its real name
+        if (verdict[0] == 'O') {
+            if ((werr = cm_commit(fname, out)))
+                verdict = "E2";
+        }
+        else {
+            cm_abandon(fname, out, resume && size != offset + nread && !werr);
+        }
 
-        gettimeofday(&stop, NULL);
+        printf("%s", verdict);
+        fflush(stdout);
+
+        ins_end(verdict[0] == 'O');
+        pf_end(nread, verdict);
+
+        if (resume) {
+            if (size != offset + nread && !werr)
+                rs_save(fname, size, md5_in, offset + nread, &md5c);
+            else
+                rs_clear(fname);
+        }
 
         secs = (stop.tv_sec - start.tv_sec) + (stop.tv_usec - start.tv_usec)/1e6;
 
         rsyslog(0, "Received %u bytes of %s (%.1f Bps)", nread, fname, nread/secs);
 
-        fclose(fp);
-
-        md5_compute(fname, md5_out);
-        if (size != nread) {
-            printf("E0");
-            rsyslog(0, "E0 %u %u", size, nread); 
+        if (size != offset + nread) {
+            rsyslog(0, "E0 %u %u", size, offset + nread); 
         }
         // this is a redundant size check in regular raw.2
         // else if (size != size2) {
         //     printf("E1");
         //    rsyslog(0, "E1 %u %u", size, size2);
         // }
-        else if (strcmp(md5_in, md5_out)) {
-            printf("E2"); 
+        else if (werr) {
+            rsyslog(0, "E2 write to %s failed (%s)", fname, strerror(werr));
+        }
+        else if (!match) {
+            md5_signature(digest, md5_out);
             rsyslog(0, "E2 %s %s", md5_in, md5_out); 
         }
         else {
-            printf("OK");
             rsyslog(0, "OK");
             // if the receiver does not receive our OK they will
             // likely try to send the file again. Only increment
@@ -216,8 +265,6 @@ batch(int argc, char *argv[])
             if (prevName) free(prevName);
             prevName = strdup(fname);
         }
-
-        fflush(stdout);
     }
 
     tcsetattr(0, TCSANOW, &orig_tios);
@@ -229,27 +276,60 @@ main(int argc, char *argv[])
 {
     struct termios tios, orig_tios;
 
-    FILE          *fp;
+    int            out;
     unsigned int   nread;
-    struct stat    statbuf;
+    unsigned int   offset = 0;
     unsigned char *sizebuf;
     unsigned char  swapbuf[4];
     unsigned int   size;
     struct timeval start, stop;
-    struct timeval timeout;
     double         secs;
-    int            fd;
-    fd_set         fds;
-    unsigned char  c;
+    int            werr;
     unsigned int   size2 = 0;
     char          *md5_in = NULL;
     char           md5_out[65];
+    int            match = 0;
+    unsigned char  digest[16];
+    struct MD5Context md5c;
+    char          *verdict;
+    int            resume = 0;
+    int            window = 1;
+    int            shift;
+
+    while (argc > 1 && argv[1][0] == '-') {
+        // -r - resumable transfer.  Partial files are kept along with a
+        // checkpoint and the offset to restart from is reported back
+        // to the sender.
+        if (strcmp(argv[1], "-r") == 0) {
+            resume = 1;
+            shift = 1;
+            // a dropped call should end the read, not the process, so
+            // the checkpoint gets written
+            signal(SIGHUP, SIG_IGN);
+        }
+        // -w N - (rawrcvb) the sender may have up to N files in flight
+        // ahead of their verdicts
+        else if (strcmp(argv[1], "-w") == 0 && argc > 2) {
+            window = atoi(argv[2]);
+            shift = 2;
+        }
+        else {
+            break;
+        }
+        argv[shift] = argv[0];
+        argv += shift;
+        argc -= shift;
+    }
 
     if (strncmp(argv[0], "rawrcvb", 7) == 0) {
-        return batch(argc, argv);
+        if (resume && window > 1) {
+            printf("NO!"); fflush(stdout);
+            return 1;
+        }
+        return batch(argc, argv, resume, window);
     }
 
-    if (argc < 2 || argc == 3 || argc > 4 || (fp = fopen(argv[1], "wb")) == NULL) {
+    if (argc < 2 || argc == 3 || argc > 4 || (resume && argc != 4)) {
         printf("NO!"); fflush(stdout);
         return 1;
     }
@@ -258,6 +338,18 @@ main(int argc, char *argv[])
         size2 = atol(argv[2]);
         md5_in = argv[3];
     }
+
+    if (resume)
+        out = rs_open(argv[1], size2, md5_in, &md5c, &offset);
+    else {
+        out = cm_open(argv[1], size2);
+        MD5Init(&md5c);
+    }
+
+    if (out < 0) {
+        printf("NO!"); fflush(stdout);
+        return 1;
+    }
  
     tcgetattr(0, &tios);
     tcgetattr(0, &orig_tios);
@@ -269,30 +361,20 @@ main(int argc, char *argv[])
 
     rsyslog(0, "ready to receive %s", argv[1]);
 
-    printf("READY!"); fflush(stdout);
-
-    nread = 0;
-    while(nread < 4) {
-        timeout.tv_sec = 20;
-        timeout.tv_usec = 0;
-        FD_ZERO(&fds);
-        FD_SET(0, &fds);
-        
-        if (select(1, &fds, NULL, NULL, &timeout) > 0) {
-            if (read(0, &c, 1) == 1) {
-                swapbuf[nread ++] = c;
-            }
-            else {
-                break;
-            }
-        }
-        else {
-            break;
-        }
+    if (resume) {
+        printf("READY!@%u!", offset); fflush(stdout);
+        if (offset)
+            rsyslog(0, "Resuming %s at %u", argv[1], offset);
+    }
+    else {
+        printf("READY!"); fflush(stdout);
     }
+
+    nread = rx_exact(0, swapbuf, 4);
     
     if (nread != 4) {
         rsyslog(0, "did not receive four size bytes for %s", argv[1]);
+        cm_abandon(argv[1], out, resume);
         return 1;
     }
 
@@ -307,59 +389,81 @@ main(int argc, char *argv[])
 
     gettimeofday(&start, NULL);
    
-    nread = 0;
-    while(nread < size) {
-        timeout.tv_sec = 20;
-        timeout.tv_usec = 0;
-        FD_ZERO(&fds);
-        FD_SET(0, &fds);
-
-        if (select(1, &fds, NULL, NULL, &timeout) > 0) {
-            if (read(0, &c, 1) == 1) {
-                fputc(c, fp);
-                nread ++;
-            }
-            else {
-                break;
-            }
+    if (offset > size)
+        offset = size;
+    if (argc == 2)
+        cm_reserve(out, 0, size);
+    pf_begin(argv[1], size, offset);
+    nread = rx_body(0, out, size - offset, argc == 4 ? md5_sink : NULL, &md5c, &werr);
+
+    gettimeofday(&stop, NULL);
+
+    if (argc == 4) {
+        if (size != offset + nread) {
+            verdict = "E0";
+        }
+        else if (size != size2) {
+            verdict = "E1";
         }
         else {
-            break;
+            MD5Final(digest, &md5c);
+            match = digest_verify(md5_in, digest);
+            verdict = (werr || !match) ? "E2" : "OK";
         }
     }
+    else {
+        // nothing to check it against - complete is as good as it gets
+        verdict = (size != offset + nread || werr) ? "E0" : "OK";
+    }
 
-    fflush(fp);
+    // Only a verified (or, unsigned, complete) file appears under its
+    // real name
+    if (verdict[0] == 'O') {
+        if ((werr = cm_commit(argv[1], out)) && argc == 4)
+            verdict = "E2";
+    }
+    else {
+        cm_abandon(argv[1], out, resume && size != offset + nread && size == size2 && !werr);
+    }
 
-    gettimeofday(&stop, NULL);
+    if (argc == 4) {
+        printf("%s", verdict);
+        fflush(stdout);
+    }
+    pf_end(nread, argc == 4 ? verdict : NULL);
+
+    if (resume) {
+        if (size != offset + nread && size == size2 && !werr)
+            rs_save(argv[1], size, md5_in, offset + nread, &md5c);
+        else
+            rs_clear(argv[1]);
+    }
 
     secs = (stop.tv_sec - start.tv_sec) + (stop.tv_usec - start.tv_usec)/1e6;
 
     rsyslog(0, "Received %u bytes of %s (%.1f Bps)", nread, argv[1], nread/secs);
-
-    fclose(fp);
+    if (werr)
+        rsyslog(0, "write to %s failed (%s)", argv[1], strerror(werr));
 
     if (argc == 4) {
-        md5_compute(argv[1], md5_out);
-        if (size != nread) {
-            printf("E0");
-            rsyslog(0, "E0 %u %u", size, nread); 
+        if (size != offset + nread) {
+            rsyslog(0, "E0 %u %u", size, offset + nread); 
         }
         else if (size != size2) {
-            printf("E1");
             rsyslog(0, "E1 %u %u", size, size2);
         }
-        else if (strcmp(md5_in, md5_out)) {
-            printf("E2"); 
+        else if (werr) {
+            rsyslog(0, "E2 write failed");
+        }
+        else if (!match) {
+            md5_signature(digest, md5_out);
             rsyslog(0, "E2 %s %s", md5_in, md5_out); 
         }
         else {
-            printf("OK");
             rsyslog(0, "OK");
         }
-
-        fflush(stdout);
     }
 
     tcsetattr(0, TCSANOW, &orig_tios);
-    return nread < size ? 1 : 0;
+    return offset + nread < size ? 1 : 0;
 }
@@ -30,17 +30,184 @@
 #include <sys/stat.h>
 #include <termios.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <time.h>
 #include <string.h>
+#include "txbuf.h"
+#include "rxbuf.h"
+#include "md5.h"
+#include "rsyslog.h"
 
-extern void rsyslog(int prio, const char *format, ...);
+
+static void
+progress(unsigned sent, unsigned size)
+{
+    fprintf(stderr,"%u bytes of %u\r", sent, size);
+}
+
+/// Logs the transmit telemetry - a summary line and the (microsecond
+/// time, bytes sent, drain time) samples taken along the way, over as
+/// many "Tx samples" records as it takes to keep each whole
+static void
+log_stats(char *fname, TxOpts *opts, TxStats *stats, unsigned sent)
+{
+    static char *flows[] = { "chunk", "mark", "end" };
+    char         line[RS_LINE_MAX / 2];
+    int          n = 0;
+    int          i;
+
+    rsyslog(0, "Tx %s %s %u bytes %ld us (%.1f Bps) %d drains avg %ld max %ld us step %u-%u",
+            fname, stats->zero_copy ? "sendfile" : flows[opts->flow], sent,
+            stats->elapsed_us, stats->elapsed_us ? sent * 1e6 / stats->elapsed_us : 0.0,
+            stats->ndrains, stats->ndrains ? stats->drain_us / stats->ndrains : 0,
+            stats->drain_max_us, stats->step_min, stats->step_max);
+
+    line[0] = 0;
+    for (i = 0 ; i < stats->nsamples ; i++) {
+        // a sample runs to 54 characters
+        n += snprintf(line + n, sizeof(line) - n, " %ld:%u:%ld",
+                      stats->samples[i].t_us, stats->samples[i].sent,
+                      stats->samples[i].drain_us);
+        if (n > (int) sizeof(line) - 64 && i < stats->nsamples - 1) {
+            rsyslog(0, "Tx samples %s%s", fname, line);
+            line[0] = 0;
+            n = 0;
+        }
+    }
+    rsyslog(0, "Tx samples %s%s", fname, line);
+}
+
+/// rawsendb - sends each of files[] in turn using the rawrcvb framing
+/// (52 byte header of 4 byte big-endian size, 16 byte name and 32
+/// character MD5, then the body) and waits for the receiver's OK, E0 or
+/// E2, sending the file again on E0/E2 up to retries times.  It does
+/// not resume, so a receiver run as rawrcvb -r (which answers each
+/// header with @offset!) ends the batch.
+/// \return 0 if every file was acknowledged OK, 1 otherwise
+static int
+batch(int nfiles, char **files, TxOpts *opts, int retries)
+{
+    struct termios tios, orig_tios, orig_in;
+    struct stat    statbuf;
+    TxStats        stats;
+    unsigned char  header[52];
+    unsigned char  reply[3];
+    unsigned int  *sizes;
+    char         (*sigs)[MD5_SIG_BUFF];
+    char         **names;
+    int           *fds;
+    unsigned int   sent;
+    int            attempt;
+    int            failed = 0;
+    int            i;
+
+    fds = calloc(nfiles, sizeof(int));
+    sizes = calloc(nfiles, sizeof(unsigned int));
+    sigs = calloc(nfiles, MD5_SIG_BUFF);
+    names = calloc(nfiles, sizeof(char *));
+    if (!fds || !sizes || !sigs || !names) {
+        printf("NO!"); fflush(stdout);
+        return 1;
+    }
+
+    // Everything is opened and hashed before we say READY so nothing
+    // but transmission happens once the glider is listening
+    for (i = 0 ; i < nfiles ; i++) {
+        names[i] = strrchr(files[i], '/') ? strrchr(files[i], '/') + 1 : files[i];
+        if (strlen(names[i]) > 15
+            || (fds[i] = open(files[i], O_RDONLY)) < 0
+            || fstat(fds[i], &statbuf) != 0) {
+            printf("NO!"); fflush(stdout);
+            return 1;
+        }
+        sizes[i] = statbuf.st_size;
+    }
+
+    if (md5_compute_files(nfiles, files, sigs) != 0) {
+        printf("NO!"); fflush(stdout);
+        return 1;
+    }
+
+    printf("READY!"); fflush(stdout);
+
+    rsyslog(0, "ready to send %d files", nfiles);
+
+    // replies come back in on stdin, so that wants to be raw as well
+    tcgetattr(0, &tios);
+    tcgetattr(0, &orig_in);
+    tios.c_iflag = IGNBRK;
+    tios.c_oflag = 0;
+    tios.c_lflag = 0;
+    tcsetattr(0, TCSANOW, &tios);
+
+    tcgetattr(1, &tios);
+    tcgetattr(1, &orig_tios);
+    tios.c_iflag = IGNBRK;
+    tios.c_oflag = 0;
+    tcsetattr(1, TCSANOW, &tios);
+
+    for (i = 0 ; i < nfiles ; i++) {
+        memset(header, 0, sizeof(header));
+        header[0] = sizes[i] >> 24;
+        header[1] = sizes[i] >> 16;
+        header[2] = sizes[i] >> 8;
+        header[3] = sizes[i];
+        memcpy(&header[4], names[i], strlen(names[i]));
+        memcpy(&header[20], sigs[i], 32);
+
+        for (attempt = 0 ; attempt <= retries ; attempt++) {
+            rsyslog(0, "Sending %u bytes of %s", sizes[i], names[i]);
+
+            if (tx_write(1, header, sizeof(header)) != sizeof(header)) {
+                rsyslog(0, "unable to send the header for %s", names[i]);
+                failed = 1;
+                goto out;
+            }
+            sent = tx_body(fds[i], 1, 0, sizes[i], opts, &stats);
+
+            rsyslog(0, "Sent %u bytes of %s", sent, names[i]);
+            log_stats(names[i], opts, &stats, sent);
+
+            if (rx_exact(0, reply, 2) != 2) {
+                rsyslog(0, "no reply for %s", names[i]);
+                failed = 1;
+                goto out;
+            }
+            reply[2] = 0;
+
+            if (reply[0] == '@') {
+                rsyslog(0, "receiver is resuming (rawrcvb -r), which rawsendb does not do");
+                failed = 1;
+                goto out;
+            }
+
+            if (strcmp((char *) reply, "OK") == 0) {
+                rsyslog(0, "OK");
+                break;
+            }
+            rsyslog(0, "%s for %s (attempt %d)", reply, names[i], attempt + 1);
+        }
+
+        if (attempt > retries) {
+            rsyslog(0, "giving up on %s", names[i]);
+            failed = 1;
+        }
+    }
+
+ out:
+    tcsetattr(1, TCSANOW, &orig_tios);
+    tcsetattr(0, TCSANOW, &orig_in);
+
+    for (i = 0 ; i < nfiles ; i++)
+        close(fds[i]);
+
+    return failed;
+}
 
 int
 main(int argc, char *argv[])
 {
-    FILE          *fp;
-    unsigned char  buff[1024];
-    int            nread;
+    int            fd;
     unsigned int   sent;
     struct stat    statbuf;
     unsigned char *sizebuf;
@@ -50,21 +217,85 @@ main(int argc, char *argv[])
     time_t         start, end;
     char          *fname = NULL;
     int            verbose = 0;
+    unsigned int   offset = 0;
+    TxOpts         opts;
+    TxStats        stats;
+    int            retries = 3;
+    int            opt;
+
+    tx_defaults(&opts);
 
-    if (argc == 3 && strcmp(argv[1], "-v") == 0) {
-        verbose = 1;    
-        fname = argv[2];
+    // -o offset - the receiver already holds the first offset bytes
+    // (from an interrupted transfer), start from there
+    // -f chunk|mark|end - when to wait for a tty's output to drain:
+    //    after every -c bytes, every -d bytes, or only at the end
+    // -a - grow or shrink the -c/-d step from the measured drain times
+    // -n retries - (rawsendb) times to resend a file the receiver
+    //    reported E0 or E2 for
+    // rawsendb does not resume, so it cannot be paired with rawrcvb -r
+    while ((opt = getopt(argc, argv, "vo:f:c:d:an:")) != -1) {
+        switch (opt) {
+        case 'v':
+            verbose = 1;
+            break;
+        case 'o':
+            offset = strtoul(optarg, NULL, 10);
+            break;
+        case 'f':
+            if (strcmp(optarg, "chunk") == 0)
+                opts.flow = TX_FLOW_CHUNK;
+            else if (strcmp(optarg, "mark") == 0)
+                opts.flow = TX_FLOW_MARK;
+            else if (strcmp(optarg, "end") == 0)
+                opts.flow = TX_FLOW_END;
+            else {
+                printf("NO!"); fflush(stdout);
+                return 1;
+            }
+            break;
+        case 'c':
+            opts.chunk = strtoul(optarg, NULL, 10);
+            break;
+        case 'd':
+            opts.mark = strtoul(optarg, NULL, 10);
+            break;
+        case 'a':
+            opts.adapt = 1;
+            break;
+        case 'n':
+            retries = atoi(optarg);
+            break;
+        default:
+            printf("NO!"); fflush(stdout);
+            return 1;
+        }
     }
-    else if (argc == 2)
-        fname = argv[1];
+
+    if (strncmp(argv[0], "rawsendb", 8) == 0) {
+        if (optind >= argc) {
+            printf("NO!"); fflush(stdout);
+            return 1;
+        }
+        return batch(argc - optind, &argv[optind], &opts, retries);
+    }
+
+    if (optind == argc - 1)
+        fname = argv[optind];
  
-    if (fname == NULL || (fp = fopen(fname, "rb")) == NULL) {
+    if (fname == NULL || (fd = open(fname, O_RDONLY)) < 0) {
         printf("NO!"); fflush(stdout);
         return 1;
     }
 
-    stat(fname, &statbuf);
+    fstat(fd, &statbuf);
     size = statbuf.st_size;
+
+    if (offset > size) {
+        printf("NO!"); fflush(stdout);
+        close(fd);
+        return 1;
+    }
+
     sizebuf = (unsigned char *) &size;
     swapbuf[3] = sizebuf[0];
     swapbuf[2] = sizebuf[1];
@@ -77,6 +308,9 @@ main(int argc, char *argv[])
         fprintf(stderr, "Sending %u bytes of %s\r\n", size, fname);
     else
         rsyslog(0, "Sending %u bytes of %s", size, fname);
+
+    if (offset)
+        rsyslog(0, "Resuming %s at %u", fname, offset);
     
     tcgetattr(1, &tios);
     tcgetattr(1, &orig_tios);
@@ -89,27 +323,21 @@ main(int argc, char *argv[])
     write(1, swapbuf, 4);
     tcdrain(1);
 
-    sent = 0;
-    while(!feof(fp)) {         
-        nread = fread(buff, sizeof(unsigned char), 1024, fp);
-        if (nread) {
-            sent += write(1, buff, nread);
-            tcdrain(1);
-        }
-        if (verbose)
-            fprintf(stderr,"%u bytes of %u\r", sent, size);
-    }
+    opts.progress = verbose ? progress : NULL;
+    sent = offset + tx_body(fd, 1, offset, size, &opts, &stats);
 
     end = time(NULL);
 
     if (verbose)    
         fprintf(stderr,"\nComplete %f bytes/sec\r\n",
-                sent / (float) (end - start));
-    else
+                (sent - offset) / (float) (end - start));
+    else {
         rsyslog(0, "Sent %u bytes of %s", sent, fname);
+        log_stats(fname, &opts, &stats, sent - offset);
+    }
 
     tcsetattr(1, TCSANOW, &orig_tios);
 
-    fclose(fp);
+    close(fd);
     return 0;
 }
@@ -0,0 +1,143 @@
+// Copyright (c) 2023  University of Washington.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the University of Washington nor the names of its
+//    contributors may be used to endorse or promote products derived from this
+//    software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY OF WASHINGTON AND CONTRIBUTORS “AS
+// IS” AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE UNIVERSITY OF WASHINGTON OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+// GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+// OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/// @file resume.c
+///
+/// A transfer that ends short (timeout or dropped call) leaves the bytes it
+/// did get in the file's temporary (see commit.c), along with a checkpoint
+/// recording how many there were and the MD5 state over them.  When the
+/// glider sends the same file again (same name, size and signature) the
+/// receiver reopens the partial file at that offset and tells the sender
+/// where to start.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "resume.h"
+#include "commit.h"
+
+/// Builds the checkpoint name - the file name with a leading dot (so
+/// the processing globs never see it) and a .ckpt extension
+static void
+rs_name(char *fname, char *ckpt, size_t n)
+{
+    char *base;
+
+    if ((base = strrchr(fname, '/')))
+        snprintf(ckpt, n, "%.*s.%s.ckpt", (int) (base - fname + 1), fname, base + 1);
+    else
+        snprintf(ckpt, n, ".%s.ckpt", fname);
+}
+
+/// Opens the temporary for fname for receiving, resuming from a
+/// checkpoint if there is one that matches the file being offered
+/// \return open descriptor positioned at *offset, -1 on error
+int
+rs_open(char *fname, unsigned size, char *md5, struct MD5Context *ctx, unsigned *offset)
+{
+    char        ckpt[1024];
+    char        tmp[1024];
+    Checkpoint  cp;
+    struct stat statbuf;
+    int         fd;
+    int         ok = 0;
+
+    *offset = 0;
+    MD5Init(ctx);
+
+    rs_name(fname, ckpt, sizeof(ckpt));
+    cm_tmpname(fname, tmp, sizeof(tmp));
+    if ((fd = open(ckpt, O_RDONLY)) >= 0) {
+        ok = read(fd, &cp, sizeof(cp)) == sizeof(cp)
+             && cp.magic == RS_MAGIC
+             && cp.size == size
+             && cp.offset < size
+             && md5_compare(cp.md5, md5) == 0
+             && stat(tmp, &statbuf) == 0
+             && statbuf.st_size >= cp.offset;
+        close(fd);
+    }
+
+    if (!ok) {
+        unlink(ckpt);
+        return cm_open(fname, size);
+    }
+
+    if ((fd = open(tmp, O_WRONLY)) < 0
+        || ftruncate(fd, cp.offset) != 0
+        || lseek(fd, cp.offset, SEEK_SET) != cp.offset) {
+        if (fd >= 0)
+            close(fd);
+        unlink(ckpt);
+        return cm_open(fname, size);
+    }
+
+    cm_reserve(fd, cp.offset, size);
+    *offset = cp.offset;
+    memcpy(ctx, &cp.md5c, sizeof(*ctx));
+    return fd;
+}
+
+/// Records that the first offset bytes of fname are on disk and
+/// digested into ctx
+void
+rs_save(char *fname, unsigned size, char *md5, unsigned offset, struct MD5Context *ctx)
+{
+    char       ckpt[1024];
+    Checkpoint cp;
+    int        fd;
+
+    memset(&cp, 0, sizeof(cp));
+    cp.magic = RS_MAGIC;
+    cp.size = size;
+    cp.offset = offset;
+    strncpy(cp.md5, md5, 32);
+    memcpy(&cp.md5c, ctx, sizeof(cp.md5c));
+
+    rs_name(fname, ckpt, sizeof(ckpt));
+    if ((fd = open(ckpt, O_WRONLY | O_CREAT | O_TRUNC, 0666)) >= 0) {
+        if (write(fd, &cp, sizeof(cp)) != sizeof(cp)) {
+            close(fd);
+            unlink(ckpt);
+            return;
+        }
+        close(fd);
+    }
+}
+
+/// Drops any checkpoint for fname
+void
+rs_clear(char *fname)
+{
+    char ckpt[1024];
+
+    rs_name(fname, ckpt, sizeof(ckpt));
+    unlink(ckpt);
+}
@@ -0,0 +1,53 @@
+// Copyright (c) 2023  University of Washington.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the University of Washington nor the names of its
+//    contributors may be used to endorse or promote products derived from this
+//    software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY OF WASHINGTON AND CONTRIBUTORS “AS
+// IS” AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE UNIVERSITY OF WASHINGTON OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+// GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+// OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/// @file resume.h
+///
+/// Checkpoints that let an interrupted rawrcv/rawrcvb transfer pick up
+/// where it left off rather than starting again from byte zero.
+
+#ifndef RESUME_H
+#define RESUME_H
+
+#include "md5.h"
+
+#define RS_MAGIC 0x52534b31   ///< Marks a checkpoint file ("RSK1")
+
+/// Contents of the .<fname>.ckpt sidecar kept next to a partial file
+typedef struct {
+    unsigned int      magic;
+    unsigned int      size;       ///< announced size of the whole file
+    unsigned int      offset;     ///< bytes of the file already on disk
+    char              md5[33];    ///< announced signature of the whole file
+    struct MD5Context md5c;       ///< digest state covering [0, offset)
+} Checkpoint;
+
+int      rs_open(char *fname, unsigned size, char *md5, struct MD5Context *ctx, unsigned *offset);
+void     rs_save(char *fname, unsigned size, char *md5, unsigned offset, struct MD5Context *ctx);
+void     rs_clear(char *fname);
+
+#endif /* !RESUME_H */
@@ -1,36 +1,125 @@
-#define _GNU_SOURCE // for VASPRINTF
+/// @file rsyslog.c
+///
+/// Appends records to $HOME/comm.log.  The log is opened once per process
+/// with O_APPEND and each record is formatted on the stack and handed to
+/// the kernel in a single write(), so lines from several gliders (or from
+/// both rawrcvb threads) never interleave.  If comm.log cannot be opened
+/// records go to syslog instead.
+///
+/// LOG_DEBUG records (per-chunk transfer progress and the like) are only
+/// written when RAWXFER_DEBUG is set in the environment, and then at most
+/// one per RS_DEBUG_INTERVAL seconds; the ones dropped in between are
+/// counted in the next one written.  When debug is off they cost a flag
+/// test - nothing is formatted.
 
 #include <stdio.h>
 #include <stdarg.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <syslog.h>
+#include "rsyslog.h"
+
+static int          logfd = -2;     // -2 not yet opened, -1 could not open
+static const char  *user = NULL;
+static int          debug = 0;
+static time_t       last_debug = 0;
+static unsigned     suppressed = 0;
+
+static void
+rsyslog_close(void)
+{
+    if (logfd >= 0)
+        close(logfd);
+    logfd = -1;
+}
+
+static void
+rsyslog_open(void)
+{
+    char  logname[1024];
+    char *home;
+    int   fd = -1;
+
+    user = getenv("USER");
+    debug = getenv(RS_DEBUG_ENV) != NULL;
+
+    if ((home = getenv("HOME"))) {
+        snprintf(logname, sizeof(logname), "%s/comm.log", home);
+        fd = open(logname, O_WRONLY | O_APPEND | O_CREAT, 0666);
+    }
+
+    // two threads may race to get here - only one descriptor is kept
+    if (!__sync_bool_compare_and_swap(&logfd, -2, fd)) {
+        if (fd >= 0)
+            close(fd);
+    }
+    else if (fd >= 0) {
+        atexit(rsyslog_close);
+    }
+}
+
+/// Where the line ends after a formatting step that added r to n - the
+/// printf family returns what it would have written, which can run
+/// past the line
+static int
+rs_end(int n, int r)
+{
+    if (r < 0)
+        return n;
+    return n + r > RS_LINE_MAX - 1 ? RS_LINE_MAX - 1 : n + r;
+}
 
 void
-rsyslog(int priority, char *format, ...)
+rsyslog(int priority, const char *format, ...)
 {
-    char    *ptr;
-    va_list  ap;
-    FILE    *fp;
-    char     logname[64];
-    time_t   now;
- 
+    char      line[RS_LINE_MAX];
+    va_list   ap;
+    time_t    now;
+    struct tm tm;
+    int       n;
+
+    if (logfd == -2)
+        rsyslog_open();
+
+    now = time(NULL);
+
+    if (priority == LOG_DEBUG) {
+        if (!debug)
+            return;
+        if (now - last_debug < RS_DEBUG_INTERVAL) {
+            suppressed ++;
+            return;
+        }
+        last_debug = now;
+    }
+
+    n = strftime(line, sizeof(line), "%Y-%m-%dT%H:%M:%SZ", gmtime_r(&now, &tm));
+    n = rs_end(n, snprintf(line + n, sizeof(line) - n, " [%s] ", user ? user : "(null)"));
+
     va_start(ap, format);
-    vasprintf(&ptr, format, ap);
+    n = rs_end(n, vsnprintf(line + n, sizeof(line) - n, format, ap));
     va_end(ap);
 
-    snprintf(logname, 63, "%s/comm.log", getenv("HOME"));
-    fp = fopen(logname, "ab");
-    if (fp == NULL) {
-        syslog(priority, "rawxfer [%s] %s", getenv("USER"), ptr);
+    if (priority == LOG_DEBUG && suppressed && n < (int) sizeof(line) - 1) {
+        n = rs_end(n, snprintf(line + n, sizeof(line) - n, " (%u suppressed)", suppressed));
+        suppressed = 0;
     }
-    else {
-        now = time(NULL);
-        strftime(logname, 63, "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
-        fprintf(fp, "%s [%s] %s\n", logname, getenv("USER"), ptr);
-        fclose(fp);
+
+    // a record too long for the line keeps its start, marked as cut
+    if (n > (int) sizeof(line) - 2) {
+        n = sizeof(line) - 2;
+        memcpy(line + n - 3, "...", 3);
+    }
+
+    if (logfd < 0) {
+        line[n] = 0;
+        syslog(priority, "rawxfer %s", strchr(line, '['));
+        return;
     }
 
-    free(ptr);
-}    
-    
+    line[n++] = '\n';
+    write(logfd, line, n);
+}
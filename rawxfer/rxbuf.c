@@ -0,0 +1,220 @@
+// Copyright (c) 2023  University of Washington.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the University of Washington nor the names of its
+//    contributors may be used to endorse or promote products derived from this
+//    software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY OF WASHINGTON AND CONTRIBUTORS “AS
+// IS” AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE UNIVERSITY OF WASHINGTON OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+// GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+// OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/// @file rxbuf.c
+///
+/// Receive engine for rawrcv/rawrcvb.  Each select() is followed by a single
+/// read() of everything the line has available (never more than the sender
+/// announced, so nothing belonging to the shell or the next header is
+/// consumed), and received data is handed to the disk in RX_BUFF_SIZE writes.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/select.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <errno.h>
+#include "rxbuf.h"
+#include "rsyslog.h"
+#include "profile.h"
+
+static unsigned char *rxbuff = NULL;
+static int            rxabort = -1;
+
+/// Makes any wait for input give up as soon as fd becomes readable
+/// (used to stop a receive thread that another thread has finished for)
+void
+rx_abort_on(int fd)
+{
+    rxabort = fd;
+}
+
+/// Waits up to RX_TIMEOUT seconds for input on fd
+/// \return 1 if input is ready, 0 on timeout, abort or error
+static int
+rx_wait(int fd)
+{
+    struct timeval timeout;
+    fd_set         fds;
+    int            nfds = fd;
+    long           t = 0;
+    int            r;
+
+    timeout.tv_sec = RX_TIMEOUT;
+    timeout.tv_usec = 0;
+    FD_ZERO(&fds);
+    FD_SET(fd, &fds);
+    if (rxabort >= 0) {
+        FD_SET(rxabort, &fds);
+        if (rxabort > nfds)
+            nfds = rxabort;
+    }
+
+    if (pf_active) {
+        t = pf_now();
+        r = select(nfds + 1, &fds, NULL, NULL, &timeout);
+        pf_wait(pf_now() - t);
+    }
+    else {
+        r = select(nfds + 1, &fds, NULL, NULL, &timeout);
+    }
+    if (r <= 0)
+        return 0;
+
+    return !(rxabort >= 0 && FD_ISSET(rxabort, &fds));
+}
+
+/// Reads whatever is available on fd, up to n bytes
+/// \return bytes read, 0 on timeout, EOF or error
+static unsigned
+rx_some(int fd, unsigned char *dst, unsigned n)
+{
+    ssize_t got;
+
+    if (!rx_wait(fd))
+        return 0;
+
+    do {
+        got = read(fd, dst, n);
+    } while (got < 0 && errno == EINTR);
+
+    if (got <= 0)
+        return 0;
+    if (pf_active)
+        pf_read(got);
+
+    return got;
+}
+
+/// Writes all of n bytes to fd
+/// \return 0 on success, errno on failure
+static int
+rx_flush(int fd, unsigned char *src, unsigned n)
+{
+    ssize_t put;
+
+    while (n) {
+        put = write(fd, src, n);
+        if (put < 0) {
+            if (errno == EINTR)
+                continue;
+            return errno;
+        }
+        src += put;
+        n -= put;
+    }
+
+    return 0;
+}
+
+/// rx_flush, with the time it takes going to the profile
+static int
+rx_timed_flush(int fd, unsigned char *src, unsigned n)
+{
+    long t;
+    int  err;
+
+    if (!pf_active)
+        return rx_flush(fd, src, n);
+
+    t = pf_now();
+    err = rx_flush(fd, src, n);
+    pf_write(pf_now() - t);
+    return err;
+}
+
+/// Receives exactly n bytes into dst (headers, size prefixes)
+/// \return number of bytes received, less than n on timeout
+unsigned
+rx_exact(int in, unsigned char *dst, unsigned n)
+{
+    unsigned nread = 0;
+    unsigned got;
+
+    while (nread < n) {
+        if ((got = rx_some(in, dst + nread, n - nread)) == 0)
+            break;
+        nread += got;
+    }
+
+    return nread;
+}
+
+/// Receives size bytes from in and writes them to out.  Stops early
+/// if the line is idle for RX_TIMEOUT seconds.  If sink is given it sees
+/// every byte, in order, as soon as it is read.  A failed write does
+/// not stop the receive (the sender is still transmitting) but is
+/// reported through werr.
+/// \return number of bytes received
+unsigned
+rx_body(int in, int out, unsigned size, rx_sink_t sink, void *arg, int *werr)
+{
+    unsigned nread = 0;
+    unsigned fill = 0;
+    unsigned want;
+    unsigned got;
+    long     t;
+    int      err;
+
+    *werr = 0;
+
+    if (rxbuff == NULL && (rxbuff = malloc(RX_BUFF_SIZE)) == NULL) {
+        *werr = ENOMEM;
+        return 0;
+    }
+
+    while (nread < size) {
+        want = RX_BUFF_SIZE - fill;
+        if (want > size - nread)
+            want = size - nread;
+
+        if ((got = rx_some(in, rxbuff + fill, want)) == 0)
+            break;
+
+        if (sink) {
+            t = pf_active ? pf_now() : 0;
+            sink(arg, rxbuff + fill, got);
+            if (pf_active)
+                pf_sink(pf_now() - t);
+        }
+
+        nread += got;
+        fill += got;
+        rsyslog(LOG_DEBUG, "Rx %u of %u", nread, size);
+
+        if (fill == RX_BUFF_SIZE) {
+            if ((err = rx_timed_flush(out, rxbuff, fill)) && *werr == 0)
+                *werr = err;
+            fill = 0;
+        }
+    }
+
+    if (fill && (err = rx_timed_flush(out, rxbuff, fill)) && *werr == 0)
+        *werr = err;
+
+    return nread;
+}
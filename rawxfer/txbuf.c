@@ -0,0 +1,296 @@
+// Copyright (c) 2023  University of Washington.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the University of Washington nor the names of its
+//    contributors may be used to endorse or promote products derived from this
+//    software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY OF WASHINGTON AND CONTRIBUTORS “AS
+// IS” AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE UNIVERSITY OF WASHINGTON OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+// GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+// OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/// @file txbuf.c
+///
+/// Transmit engine for rawsend.  When stdout is a pipe or socket (rawsend
+/// run under ssh or a network bridge rather than on a serial line) the
+/// file goes out with sendfile() and never passes through user space.  On
+/// a tty it is read TX_BUFF_SIZE at a time and written according to the
+/// flow control mode:
+///
+///   TX_FLOW_CHUNK - chunk sized writes, each followed by tcdrain()
+///   TX_FLOW_MARK  - tcdrain() once every mark bytes
+///   TX_FLOW_END   - full buffer writes, one tcdrain() at the very end
+///
+/// With adapt set the chunk (or mark) is doubled while drains come back in
+/// under TX_DRAIN_LO_US and halved when one takes over TX_DRAIN_HI_US, so
+/// each link settles on a step that keeps the line busy without long
+/// blind stalls.  Every drain is timed and sampled into TxStats.
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/sendfile.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#include <errno.h>
+#include "txbuf.h"
+#include "rsyslog.h"
+
+static unsigned char *txbuff = NULL;
+
+void
+tx_defaults(TxOpts *opts)
+{
+    opts->flow = TX_FLOW_MARK;
+    opts->chunk = TX_CHUNK;
+    opts->mark = TX_MARK;
+    opts->adapt = 0;
+    opts->progress = NULL;
+}
+
+static long
+usecs(struct timeval *since)
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    return (now.tv_sec - since->tv_sec) * 1000000L + (now.tv_usec - since->tv_usec);
+}
+
+/// Records a sample, thinning the ones already kept by half whenever
+/// the table fills so it always spans the whole transfer
+static void
+tx_sample(TxStats *stats, long t_us, unsigned sent, long drain_us)
+{
+    int i;
+
+    if (stats->seen++ % stats->stride)
+        return;
+
+    if (stats->nsamples == TX_MAX_SAMPLES) {
+        for (i = 0 ; i < TX_MAX_SAMPLES / 2 ; i++)
+            stats->samples[i] = stats->samples[2*i + 1];
+        stats->nsamples = TX_MAX_SAMPLES / 2;
+        stats->stride *= 2;
+    }
+
+    stats->samples[stats->nsamples].t_us = t_us;
+    stats->samples[stats->nsamples].sent = sent;
+    stats->samples[stats->nsamples].drain_us = drain_us;
+    stats->nsamples ++;
+}
+
+/// Timed tcdrain()
+static long
+tx_drain(int out, TxStats *stats)
+{
+    struct timeval start;
+    long           us;
+
+    gettimeofday(&start, NULL);
+    tcdrain(out);
+    us = usecs(&start);
+
+    stats->ndrains ++;
+    stats->drain_us += us;
+    if (us > stats->drain_max_us)
+        stats->drain_max_us = us;
+
+    return us;
+}
+
+/// Adjusts the step after a drain that took us
+static unsigned
+tx_adapt(unsigned step, long us)
+{
+    if (us < TX_DRAIN_LO_US && step < TX_BUFF_SIZE)
+        return step * 2;
+    if (us > TX_DRAIN_HI_US && step > TX_STEP_MIN)
+        return step / 2;
+    return step;
+}
+
+/// Writes all of n bytes to fd
+/// \return bytes written (less than n only on error)
+unsigned
+tx_write(int fd, unsigned char *src, unsigned n)
+{
+    unsigned done = 0;
+    ssize_t  put;
+
+    while (done < n) {
+        put = write(fd, src + done, n - done);
+        if (put < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        done += put;
+    }
+
+    return done;
+}
+
+/// Zero copy path - file straight to a pipe or socket
+/// \return bytes sent, or -1 if sendfile() is not usable here
+static long
+tx_sendfile(int in, int out, unsigned offset, unsigned size,
+            TxOpts *opts, TxStats *stats, struct timeval *start)
+{
+    struct pollfd pfd = { out, POLLOUT, 0 };
+    off_t         off = offset;
+    unsigned      sent = 0;
+    ssize_t       put;
+
+    while (sent < size - offset) {
+        put = sendfile(out, in, &off, size - offset - sent);
+        if (put < 0) {
+            if (errno == EINTR)
+                continue;
+            // a non-blocking out is full - wait for the peer to drain
+            // it rather than spin
+            if (errno == EAGAIN) {
+                if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+                    break;
+                continue;
+            }
+            if (sent == 0 && (errno == EINVAL || errno == ENOSYS))
+                return -1;
+            break;
+        }
+        if (put == 0)
+            break;
+        sent += put;
+        tx_sample(stats, usecs(start), sent, 0);
+        if (opts->progress)
+            opts->progress(offset + sent, size);
+        rsyslog(LOG_DEBUG, "Tx %u of %u", offset + sent, size);
+    }
+
+    stats->zero_copy = 1;
+    return sent;
+}
+
+/// Sends bytes [offset, size) of in to out
+/// \return number of bytes sent
+unsigned
+tx_body(int in, int out, unsigned offset, unsigned size,
+        TxOpts *opts, TxStats *stats)
+{
+    struct stat    statbuf;
+    struct timeval start;
+    unsigned       sent = 0;
+    unsigned       since_drain = 0;
+    unsigned       step;
+    unsigned       want;
+    unsigned       piece;
+    unsigned       put;
+    ssize_t        nread;
+    unsigned       i;
+    long           zc;
+    long           us;
+
+    memset(stats, 0, sizeof(*stats));
+    stats->stride = 1;
+    gettimeofday(&start, NULL);
+
+    if (fstat(out, &statbuf) == 0
+        && (S_ISFIFO(statbuf.st_mode) || S_ISSOCK(statbuf.st_mode))
+        && (zc = tx_sendfile(in, out, offset, size, opts, stats, &start)) >= 0) {
+        stats->elapsed_us = usecs(&start);
+        return zc;
+    }
+
+    switch (opts->flow) {
+    case TX_FLOW_CHUNK:
+        step = opts->chunk ? opts->chunk : TX_CHUNK;
+        break;
+    case TX_FLOW_MARK:
+        step = opts->mark ? opts->mark : TX_MARK;
+        break;
+    default:
+        step = TX_BUFF_SIZE;
+        break;
+    }
+    stats->step_min = stats->step_max = step;
+
+    if (txbuff == NULL && (txbuff = malloc(TX_BUFF_SIZE)) == NULL)
+        return 0;
+
+    if (lseek(in, offset, SEEK_SET) != offset)
+        return 0;
+
+    while (offset + sent < size) {
+        want = size - offset - sent;
+        if (want > TX_BUFF_SIZE)
+            want = TX_BUFF_SIZE;
+
+        nread = read(in, txbuff, want);
+        if (nread < 0 && errno == EINTR)
+            continue;
+        if (nread <= 0)
+            break;
+
+        for (i = 0 ; i < nread ; i += put) {
+            piece = nread - i;
+            if (opts->flow != TX_FLOW_END && piece > step - since_drain)
+                piece = step - since_drain;
+
+            put = tx_write(out, txbuff + i, piece);
+            sent += put;
+            since_drain += put;
+            if (put < piece)
+                goto done;
+
+            if (opts->flow != TX_FLOW_END && since_drain >= step) {
+                us = tx_drain(out, stats);
+                tx_sample(stats, usecs(&start), sent, us);
+                since_drain = 0;
+                if (opts->adapt) {
+                    step = tx_adapt(step, us);
+                    if (step < stats->step_min)
+                        stats->step_min = step;
+                    if (step > stats->step_max)
+                        stats->step_max = step;
+                }
+            }
+            else if (opts->flow == TX_FLOW_END) {
+                tx_sample(stats, usecs(&start), sent, 0);
+            }
+            if (opts->progress)
+                opts->progress(offset + sent, size);
+            rsyslog(LOG_DEBUG, "Tx %u of %u", offset + sent, size);
+        }
+    }
+
+ done:
+    if (since_drain) {
+        us = tx_drain(out, stats);
+        tx_sample(stats, usecs(&start), sent, us);
+    }
+
+    stats->elapsed_us = usecs(&start);
+    return sent;
+}
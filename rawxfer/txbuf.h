@@ -0,0 +1,85 @@
+// Copyright (c) 2023  University of Washington.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice, this
+//    list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the University of Washington nor the names of its
+//    contributors may be used to endorse or promote products derived from this
+//    software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY OF WASHINGTON AND CONTRIBUTORS “AS
+// IS” AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL THE UNIVERSITY OF WASHINGTON OR CONTRIBUTORS BE
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+// GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+// HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+// LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+// OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/// @file txbuf.h
+///
+/// Transmit engine used by rawsend
+
+#ifndef TXBUF_H
+#define TXBUF_H
+
+#define TX_BUFF_SIZE   65536  ///< Bytes read from disk per buffered write
+#define TX_CHUNK       1024   ///< Default bytes per write in TX_FLOW_CHUNK mode
+#define TX_MARK        8192   ///< Default bytes written between tcdrain()s
+#define TX_STEP_MIN    256    ///< Smallest chunk/mark adaptation will go to
+#define TX_DRAIN_LO_US 20000  ///< Drains quicker than this grow the step
+#define TX_DRAIN_HI_US 500000 ///< Drains slower than this shrink it
+#define TX_MAX_SAMPLES 64     ///< Throughput samples kept per file
+
+#define TX_FLOW_CHUNK  0      ///< tcdrain() after every chunk (the original)
+#define TX_FLOW_MARK   1      ///< tcdrain() once per watermark bytes
+#define TX_FLOW_END    2      ///< tcdrain() only once it has all been written
+
+/// Called after each block goes out with the running count
+typedef void (*tx_progress_t)(unsigned sent, unsigned size);
+
+typedef struct {
+    int           flow;       ///< one of the TX_FLOW_ modes
+    unsigned      chunk;      ///< bytes per write in TX_FLOW_CHUNK mode
+    unsigned      mark;       ///< bytes between drains in TX_FLOW_MARK mode
+    int           adapt;      ///< resize chunk/mark from the measured drain time
+    tx_progress_t progress;
+} TxOpts;
+
+/// Body bytes sent by t_us, and how long the drain that ended the
+/// sample took
+typedef struct {
+    long          t_us;
+    unsigned      sent;
+    long          drain_us;
+} TxSample;
+
+typedef struct {
+    TxSample      samples[TX_MAX_SAMPLES];
+    int           nsamples;
+    int           stride;     ///< keeping every stride'th sample
+    int           seen;
+    int           ndrains;
+    long          drain_us;   ///< total time spent in tcdrain()
+    long          drain_max_us;
+    unsigned      step_min;   ///< range the adaptive step covered
+    unsigned      step_max;
+    long          elapsed_us;
+    int           zero_copy;
+} TxStats;
+
+void     tx_defaults(TxOpts *opts);
+unsigned tx_write(int fd, unsigned char *src, unsigned n);
+unsigned tx_body(int in, int out, unsigned offset, unsigned size,
+                 TxOpts *opts, TxStats *stats);
+
+#endif /* !TXBUF_H */